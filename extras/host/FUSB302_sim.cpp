@@ -0,0 +1,670 @@
+
+/**
+ * FUSB302_sim.cpp
+ *
+ * Register level FUSB302 model for host (Linux) builds
+ * See FUSB302_sim.h
+ *
+ * Reference: FUSB302B datasheet Rev. 4, Table 16 - Register Definitions
+ *
+ */
+
+#include <string.h>
+#include "FUSB302_sim.h"
+
+/* Register addresses and bits, kept private to the model on purpose.
+   The driver has its own copy, a typo in one of them must not hide in the other. */
+#define ADDRESS_DEVICE_ID   0x01
+#define ADDRESS_SWITCHES0   0x02
+#define ADDRESS_SWITCHES1   0x03
+#define ADDRESS_MEASURE     0x04
+#define ADDRESS_SLICE       0x05
+#define ADDRESS_CONTROL0    0x06
+#define ADDRESS_CONTROL1    0x07
+#define ADDRESS_CONTROL2    0x08
+#define ADDRESS_CONTROL3    0x09
+#define ADDRESS_MASK        0x0A
+#define ADDRESS_POWER       0x0B
+#define ADDRESS_RESET       0x0C
+#define ADDRESS_OCPREG      0x0D
+#define ADDRESS_MASKA       0x0E
+#define ADDRESS_MASKB       0x0F
+#define ADDRESS_CONTROL4    0x10
+#define ADDRESS_STATUS0A    0x3C
+#define ADDRESS_STATUS1A    0x3D
+#define ADDRESS_INTERRUPTA  0x3E
+#define ADDRESS_INTERRUPTB  0x3F
+#define ADDRESS_STATUS0     0x40
+#define ADDRESS_STATUS1     0x41
+#define ADDRESS_INTERRUPT   0x42
+#define ADDRESS_FIFOS       0x43
+
+#define MEAS_CC2        (0x01 << 3)
+#define MEAS_CC1        (0x01 << 2)
+#define AUTO_CRC        (0x01 << 2)
+#define TXCC2           (0x01 << 1)
+#define TXCC1           (0x01 << 0)
+#define TX_FLUSH        (0x01 << 6)
+#define INT_MASK        (0x01 << 5)
+#define TX_START        (0x01 << 0)
+#define RX_FLUSH        (0x01 << 2)
+#define SEND_HARDRESET  (0x01 << 6)
+#define N_RETRIES(r)    (((r) >> 1) & 0x03)
+#define PWR_INT_OSC     (0x01 << 3)
+#define PWR_MEASURE     (0x01 << 2)
+#define PWR_RECEIVER    (0x01 << 1)
+#define PWR_BANDGAP     (0x01 << 0)
+#define WAKE_EN         (0x01 << 3)
+#define PD_RESET        (0x01 << 1)
+#define SW_RES          (0x01 << 0)
+
+#define RETRYFAIL       (0x01 << 4)
+#define HARDRST         (0x01 << 0)
+#define RXSOP           (0x01 << 0)
+#define I_RETRYFAIL     (0x01 << 4)
+#define I_HARDSENT      (0x01 << 3)
+#define I_TXSENT        (0x01 << 2)
+#define I_HARDRST       (0x01 << 0)
+#define I_GCRCSENT      (0x01 << 0)
+#define VBUSOK          (0x01 << 7)
+#define ACTIVITY        (0x01 << 6)
+#define CRC_CHK         (0x01 << 4)
+#define RX_EMPTY        (0x01 << 5)
+#define RX_FULL         (0x01 << 4)
+#define TX_EMPTY        (0x01 << 3)
+#define TX_FULL         (0x01 << 2)
+#define I_VBUSOK        (0x01 << 7)
+#define I_ACTIVITY      (0x01 << 6)
+#define I_CRC_CHK       (0x01 << 4)
+#define I_WAKE          (0x01 << 2)
+#define WAKE            (0x01 << 2)
+#define I_BC_LVL        (0x01 << 0)
+
+#define TX_TOKEN_TXON       0xA1
+#define TX_TOKEN_SOP1       0x12
+#define TX_TOKEN_SOP2       0x13
+#define TX_TOKEN_PACKSYM    0x80
+#define TX_TOKEN_JAM_CRC    0xFF
+#define TX_TOKEN_EOP        0x14
+#define TX_TOKEN_TXOFF      0xFE
+#define RX_TOKEN_SOP        0xE0
+
+#define SIM_TX_BUSY_PACKET      1
+#define SIM_TX_BUSY_HARD_RESET  2
+
+static const uint8_t reg_default[ADDRESS_CONTROL4 + 1] = {
+    0x00, 0x91, 0x03, 0x20, 0x31, 0x60, 0x24, 0x00,     /* 00h...07h, DEVICE_ID ver B rev B */
+    0x02, 0x06, 0x00, 0x01, 0x00, 0x0F, 0x00, 0x00,     /* 08h...0Fh */
+    0x00                                                /* 10h */
+};
+
+static FUSB302_sim_bus_t * sim_bus_selected;
+
+/* BMC at 300 kbit/s, 4b5b coded: preamble 64 bit, SOP 20 bit, 10 bit per byte, EOP 5 bit */
+static uint32_t sim_bmc_time_us(uint8_t bytes)
+{
+    uint32_t bits = 64 + 20 + (uint32_t)bytes * 10 + 5;
+    return bits * 10 / 3;
+}
+
+static uint32_t sim_i2c_time_us(FUSB302_sim_bus_t *bus, uint32_t bytes)
+{
+    /* 9 clocks per byte incl. ACK, 2 clocks for START and STOP */
+    return (uint32_t)(((uint64_t)(bytes * 9 + 2) * 1000000 + bus->clock_hz - 1) / bus->clock_hz);
+}
+
+static void sim_async_complete(FUSB302_sim_bus_t *bus)
+{
+    bus->async_pending = 0;
+    if (bus->on_async_done) {
+        bus->on_async_done(bus->async_context, FUSB302_SUCCESS);
+    }
+}
+
+static uint32_t sim_account_async(FUSB302_sim_bus_t *bus, uint32_t bytes)
+{
+    uint32_t t = sim_i2c_time_us(bus, bytes) + bus->latency_us;
+    bus->stats.transactions += 1;
+    bus->stats.bytes += bytes;
+    bus->stats.bus_time_us += t;
+    return t;
+}
+
+static void sim_account(FUSB302_sim_bus_t *bus, uint32_t bytes)
+{
+    if (bus->async_pending) {
+        /* bus busy, wait for the transfer in flight */
+        uint32_t wait = (int32_t)(bus->async_done_us - bus->time_us) > 0 ? bus->async_done_us - bus->time_us : 0;
+        bus->time_us += wait;
+        bus->stats.blocked_us += wait;
+        sim_async_complete(bus);
+    }
+    uint32_t t = sim_account_async(bus, bytes);
+    bus->time_us += t;
+    bus->stats.blocked_us += t;
+}
+
+static FUSB302_sim_t * sim_find(FUSB302_sim_bus_t *bus, uint8_t address)
+{
+    if (bus) {
+        for (uint8_t i = 0; i < FUSB302_SIM_MAX_DEVICES; i++) {
+            if (bus->device[i] && bus->device[i]->address == address) {
+                return bus->device[i];
+            }
+        }
+    }
+    return 0;
+}
+
+static uint8_t sim_measured_cc(FUSB302_sim_t *sim)
+{
+    uint8_t sw0 = sim->reg[ADDRESS_SWITCHES0];
+    return (sw0 & MEAS_CC1) ? 1 : (sw0 & MEAS_CC2) ? 2 : 0;
+}
+
+/* The VBUSOK comparator is modelled as part of the measure block */
+static uint8_t sim_vbusok(FUSB302_sim_t *sim)
+{
+    return sim->vbus && (sim->reg[ADDRESS_POWER] & PWR_MEASURE);
+}
+
+/* Wake circuit sees the partner's Rp on either CC pin */
+static uint8_t sim_wake(FUSB302_sim_t *sim)
+{
+    return sim->rp_cc && (sim->reg[ADDRESS_POWER] & PWR_BANDGAP) && (sim->reg[ADDRESS_CONTROL2] & WAKE_EN);
+}
+
+static uint8_t sim_bc_lvl(FUSB302_sim_t *sim)
+{
+    uint8_t cc = sim_measured_cc(sim);
+    if (cc && cc == sim->rp_cc && (sim->reg[ADDRESS_POWER] & PWR_MEASURE)) {
+        return sim->rp_level & 0x3;
+    }
+    return 0;
+}
+
+static void sim_rx_flush(FUSB302_sim_t *sim)
+{
+    sim->rx_read = 0;
+    sim->rx_count = 0;
+}
+
+static void sim_rx_push(FUSB302_sim_t *sim, uint8_t b)
+{
+    sim->rx_fifo[(sim->rx_read + sim->rx_count) % FUSB302_SIM_RX_FIFO_SIZE] = b;
+    sim->rx_count++;
+}
+
+static bool sim_rx_packet(FUSB302_sim_t *sim, uint16_t header, const uint32_t *obj)
+{
+    uint8_t n = (header >> 12) & 0x7;
+    if (sim->rx_count + 3 + n * 4 + 4 > FUSB302_SIM_RX_FIFO_SIZE) {
+        sim->rx_dropped++;
+        return false;
+    }
+    sim_rx_push(sim, RX_TOKEN_SOP);
+    sim_rx_push(sim, header & 0xFF);
+    sim_rx_push(sim, header >> 8);
+    for (uint8_t i = 0; i < n; i++) {
+        for (uint8_t k = 0; k < 4; k++) {
+            sim_rx_push(sim, (obj[i] >> (k * 8)) & 0xFF);
+        }
+    }
+    for (uint8_t k = 0; k < 4; k++) {
+        sim_rx_push(sim, 0xC5);     /* CRC is checked by the PHY, content is not modelled */
+    }
+    sim->reg[ADDRESS_STATUS1A] |= RXSOP;
+    sim->reg[ADDRESS_INTERRUPT] |= I_ACTIVITY | I_CRC_CHK;
+    return true;
+}
+
+static void sim_reset(FUSB302_sim_t *sim)
+{
+    memset(sim->reg, 0, sizeof(sim->reg));
+    memcpy(sim->reg, reg_default, sizeof(reg_default));
+    sim_rx_flush(sim);
+    sim->tx_count = 0;
+    sim->tx_busy = 0;
+    sim->last_bc_lvl = 0;
+    sim->last_vbusok = 0;
+    sim->last_wake = 0;
+}
+
+static void sim_tx_start(FUSB302_sim_t *sim)
+{
+    /* Parse token stream: SOP ordered set, PACKSYM with payload, JAM_CRC, EOP, TXOFF, TXON */
+    uint8_t payload[30];
+    uint8_t len = 0;
+    for (uint8_t i = 0; i < sim->tx_count; i++) {
+        uint8_t t = sim->tx_fifo[i];
+        if ((t & 0xE0) == TX_TOKEN_PACKSYM) {
+            uint8_t n = t & 0x1F;
+            for (uint8_t k = 0; k < n && i + 1 < sim->tx_count; k++) {
+                if (len < sizeof(payload)) {
+                    payload[len++] = sim->tx_fifo[++i];
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+    sim->tx_count = 0;
+    sim->reg[ADDRESS_STATUS0A] &= ~RETRYFAIL;
+    if (len < 2) {
+        return;
+    }
+    sim->tx_header = (uint16_t)payload[0] | ((uint16_t)payload[1] << 8);
+    uint8_t n = (sim->tx_header >> 12) & 0x7;
+    memset(sim->tx_obj, 0, sizeof(sim->tx_obj));
+    for (uint8_t i = 0; i < n && 2 + i * 4 + 3 < len; i++) {
+        const uint8_t *b = &payload[2 + i * 4];
+        sim->tx_obj[i] = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    }
+    uint32_t t = sim_bmc_time_us(2 + n * 4 + 4);
+    if (sim->partner_ack) {
+        t += 195 + sim_bmc_time_us(6);  /* tReceive: GoodCRC reply from partner */
+    } else {
+        t = (t + 1000) * (N_RETRIES(sim->reg[ADDRESS_CONTROL3]) + 1);  /* tRetry per attempt */
+    }
+    sim->tx_busy = SIM_TX_BUSY_PACKET;
+    sim->tx_done_us = sim->bus->time_us + t;
+}
+
+static void sim_tx_complete(FUSB302_sim_t *sim)
+{
+    uint8_t sw1 = sim->reg[ADDRESS_SWITCHES1];
+    uint8_t on_cc = (sim->rp_cc == 1 && (sw1 & TXCC1)) || (sim->rp_cc == 2 && (sw1 & TXCC2));
+    bool oscillator = sim->reg[ADDRESS_POWER] & PWR_INT_OSC;
+    sim->tx_busy = 0;
+    if (on_cc && oscillator && sim->partner_ack) {
+        /* Partner received the packet and answers GoodCRC, the PHY places it into the RX FIFO */
+        uint16_t h = sim->tx_header;
+        uint16_t good_crc = 0x0001 |                    /* GoodCRC */
+                            (1 << 5) |                  /* Port data role DFP */
+                            (h & (0x3 << 6)) |          /* Specification revision */
+                            (1 << 8) |                  /* Port power role Source */
+                            (h & (0x7 << 9));           /* MessageID */
+        sim->tx_packets++;
+        sim->reg[ADDRESS_INTERRUPTA] |= I_TXSENT;
+        if (sw1 & AUTO_CRC) {
+            sim_rx_packet(sim, good_crc, 0);
+        }
+        if (sim->on_tx) {
+            sim->on_tx(sim, sim->tx_header, sim->tx_obj);
+        }
+    } else {
+        sim->reg[ADDRESS_STATUS0A] |= RETRYFAIL;
+        sim->reg[ADDRESS_INTERRUPTA] |= I_RETRYFAIL;
+    }
+}
+
+void FUSB302_sim_update(FUSB302_sim_t *sim)
+{
+    if (sim->tx_busy && (int32_t)(sim->bus->time_us - sim->tx_done_us) >= 0) {
+        if (sim->tx_busy == SIM_TX_BUSY_HARD_RESET) {
+            sim->tx_busy = 0;
+            sim->hard_resets++;
+            sim->reg[ADDRESS_INTERRUPTA] |= I_HARDSENT;
+            if (sim->on_hard_reset) {
+                sim->on_hard_reset(sim);
+            }
+        } else {
+            sim_tx_complete(sim);
+        }
+    }
+    uint8_t bc_lvl = sim_bc_lvl(sim);
+    if (bc_lvl != sim->last_bc_lvl) {
+        sim->last_bc_lvl = bc_lvl;
+        sim->reg[ADDRESS_INTERRUPT] |= I_BC_LVL;
+    }
+    uint8_t vbusok = sim_vbusok(sim);
+    if (vbusok != sim->last_vbusok) {
+        sim->last_vbusok = vbusok;
+        sim->reg[ADDRESS_INTERRUPT] |= I_VBUSOK;
+    }
+    uint8_t wake = sim_wake(sim);
+    if (wake && !sim->last_wake) {
+        sim->reg[ADDRESS_INTERRUPT] |= I_WAKE;
+    }
+    sim->last_wake = wake;
+    if ((sim->reg[ADDRESS_POWER] & (PWR_RECEIVER | PWR_MEASURE | PWR_INT_OSC)) == 0) {
+        sim->low_power_us += sim->bus->time_us - sim->last_update_us;
+    }
+    sim->last_update_us = sim->bus->time_us;
+}
+
+static void sim_update_status1(FUSB302_sim_t *sim)
+{
+    uint8_t status1 = 0;
+    if (sim->rx_count == 0) {
+        status1 |= RX_EMPTY;
+    } else if (sim->rx_count == FUSB302_SIM_RX_FIFO_SIZE) {
+        status1 |= RX_FULL;
+    }
+    if (sim->tx_count == 0) {
+        status1 |= TX_EMPTY;
+    } else if (sim->tx_count == FUSB302_SIM_TX_FIFO_SIZE) {
+        status1 |= TX_FULL;
+    }
+    sim->reg[ADDRESS_STATUS1] = status1;
+}
+
+static void sim_update_status(FUSB302_sim_t *sim)
+{
+    uint8_t status0 = sim->reg[ADDRESS_STATUS0] & CRC_CHK;
+    uint8_t bc_lvl = sim_bc_lvl(sim);
+    if (sim->bc_lvl_glitch) {
+        /* Noisy line: every other read is off by one level */
+        bc_lvl ^= sim->bc_lvl_glitch & 0x1;
+        sim->bc_lvl_glitch--;
+        sim->reg[ADDRESS_INTERRUPT] |= I_BC_LVL;
+    }
+    if (sim_vbusok(sim)) {
+        status0 |= VBUSOK;
+    }
+    if (sim_wake(sim)) {
+        status0 |= WAKE;
+    }
+    if (sim->tx_busy) {
+        status0 |= ACTIVITY;
+    }
+    sim->reg[ADDRESS_STATUS0] = status0 | bc_lvl;
+    sim_update_status1(sim);
+}
+
+static uint8_t sim_reg_read(FUSB302_sim_t *sim, uint8_t address)
+{
+    uint8_t value;
+    if (address == ADDRESS_FIFOS) {
+        if (sim->rx_count == 0) {
+            return 0;
+        }
+        value = sim->rx_fifo[sim->rx_read];
+        sim->rx_read = (sim->rx_read + 1) % FUSB302_SIM_RX_FIFO_SIZE;
+        if (--sim->rx_count == 0) {
+            sim->reg[ADDRESS_STATUS1A] &= ~RXSOP;
+        }
+        return value;
+    }
+    if (address > ADDRESS_CONTROL4 && address < ADDRESS_STATUS0A) {
+        return 0;
+    }
+    if (address == ADDRESS_STATUS0) {
+        sim_update_status(sim);
+    } else if (address == ADDRESS_STATUS1) {
+        sim_update_status1(sim);
+    }
+    value = sim->reg[address];
+    switch (address) {
+    case ADDRESS_INTERRUPTA:
+    case ADDRESS_INTERRUPTB:
+    case ADDRESS_INTERRUPT:
+        sim->reg[address] = 0;  /* clear on read */
+        break;
+    case ADDRESS_RESET:
+        value = 0;
+        break;
+    }
+    return value;
+}
+
+static bool sim_tx_last_is_token(FUSB302_sim_t *sim)
+{
+    /* Bytes after PACKSYM are payload, a payload byte equal to TXON does not start TX */
+    uint8_t i = 0;
+    while (i + 1 < sim->tx_count) {
+        uint8_t t = sim->tx_fifo[i];
+        i += (t & 0xE0) == TX_TOKEN_PACKSYM ? (t & 0x1F) + 1 : 1;
+    }
+    return i + 1 == sim->tx_count;
+}
+
+static void sim_reg_write(FUSB302_sim_t *sim, uint8_t address, uint8_t value)
+{
+    switch (address) {
+    case ADDRESS_FIFOS:
+        if (sim->tx_count < FUSB302_SIM_TX_FIFO_SIZE) {
+            sim->tx_fifo[sim->tx_count++] = value;
+        }
+        if (value == TX_TOKEN_TXON && sim_tx_last_is_token(sim)) {
+            sim_tx_start(sim);
+        }
+        return;
+    case ADDRESS_DEVICE_ID:
+        return;
+    case ADDRESS_CONTROL0:
+        if (value & TX_FLUSH) {
+            sim->tx_count = 0;
+        }
+        sim->reg[address] = value & ~(TX_FLUSH | TX_START);
+        if (value & TX_START) {
+            sim_tx_start(sim);
+        }
+        return;
+    case ADDRESS_CONTROL1:
+        if (value & RX_FLUSH) {
+            sim_rx_flush(sim);
+        }
+        sim->reg[address] = value & ~RX_FLUSH;
+        return;
+    case ADDRESS_CONTROL3:
+        sim->reg[address] = value & ~SEND_HARDRESET;
+        if (value & SEND_HARDRESET) {
+            sim->tx_busy = SIM_TX_BUSY_HARD_RESET;
+            sim->tx_done_us = sim->bus->time_us + sim_bmc_time_us(0) * 2;
+        }
+        return;
+    case ADDRESS_RESET:
+        if (value & SW_RES) {
+            sim_reset(sim);
+        } else if (value & PD_RESET) {
+            sim_rx_flush(sim);
+            sim->tx_count = 0;
+            sim->tx_busy = 0;
+            sim->reg[ADDRESS_STATUS0A] &= ~(HARDRST | RETRYFAIL);
+        }
+        return;
+    default:
+        if (address <= ADDRESS_CONTROL4) {
+            sim->reg[address] = value;
+        }
+        return;
+    }
+}
+
+void FUSB302_sim_bus_init(FUSB302_sim_bus_t *bus, uint32_t clock_hz)
+{
+    memset(bus, 0, sizeof(FUSB302_sim_bus_t));
+    bus->clock_hz = clock_hz ? clock_hz : 100000;
+}
+
+void FUSB302_sim_bus_select(FUSB302_sim_bus_t *bus)
+{
+    sim_bus_selected = bus;
+}
+
+FUSB302_sim_bus_t * FUSB302_sim_bus_selected(void)
+{
+    return sim_bus_selected;
+}
+
+void FUSB302_sim_advance(FUSB302_sim_bus_t *bus, uint32_t us)
+{
+    bus->time_us += us;
+    for (uint8_t i = 0; i < FUSB302_SIM_MAX_DEVICES; i++) {
+        if (bus->device[i]) {
+            FUSB302_sim_update(bus->device[i]);
+        }
+    }
+    if (bus->async_pending && (int32_t)(bus->time_us - bus->async_done_us) >= 0) {
+        sim_async_complete(bus);
+    }
+}
+
+void FUSB302_sim_init(FUSB302_sim_t *sim, FUSB302_sim_bus_t *bus, uint8_t address)
+{
+    memset(sim, 0, sizeof(FUSB302_sim_t));
+    sim->bus = bus;
+    sim->address = address;
+    sim->partner_ack = 1;
+    sim_reset(sim);
+    sim->last_update_us = bus->time_us;
+    for (uint8_t i = 0; i < FUSB302_SIM_MAX_DEVICES; i++) {
+        if (bus->device[i] == 0) {
+            bus->device[i] = sim;
+            break;
+        }
+    }
+}
+
+void FUSB302_sim_set_vbus(FUSB302_sim_t *sim, uint8_t present)
+{
+    sim->vbus = present;
+    FUSB302_sim_update(sim);
+}
+
+void FUSB302_sim_set_rp(FUSB302_sim_t *sim, uint8_t cc, uint8_t level)
+{
+    sim->rp_cc = cc;
+    sim->rp_level = level;
+    FUSB302_sim_update(sim);
+}
+
+enum FUSB302_sim_rx_t FUSB302_sim_receive(FUSB302_sim_t *sim, uint16_t header, const uint32_t *obj)
+{
+    /* The BMC receiver listens on the measured CC pin */
+    uint8_t cc = sim_measured_cc(sim);
+    if (cc == 0 || cc != sim->rp_cc || (sim->reg[ADDRESS_POWER] & PWR_RECEIVER) == 0) {
+        sim->rx_dropped++;
+        return FUSB302_SIM_RX_DROPPED;
+    }
+    if (!sim_rx_packet(sim, header, obj)) {
+        return FUSB302_SIM_RX_DROPPED;
+    }
+    sim->rx_packets++;
+    if ((sim->reg[ADDRESS_SWITCHES1] & AUTO_CRC) && (sim->reg[ADDRESS_POWER] & PWR_INT_OSC)) {
+        sim->reg[ADDRESS_INTERRUPTB] |= I_GCRCSENT;
+        return FUSB302_SIM_RX_GOOD_CRC;
+    }
+    return FUSB302_SIM_RX_STORED;
+}
+
+void FUSB302_sim_receive_hard_reset(FUSB302_sim_t *sim)
+{
+    sim_rx_flush(sim);
+    sim->reg[ADDRESS_STATUS0A] |= HARDRST;
+    sim->reg[ADDRESS_INTERRUPTA] |= I_HARDRST;
+}
+
+bool FUSB302_sim_int_asserted(FUSB302_sim_t *sim)
+{
+    FUSB302_sim_update(sim);
+    if (sim->reg[ADDRESS_CONTROL0] & INT_MASK) {
+        return false;
+    }
+    return (sim->reg[ADDRESS_INTERRUPT] & ~sim->reg[ADDRESS_MASK]) ||
+           (sim->reg[ADDRESS_INTERRUPTA] & ~sim->reg[ADDRESS_MASKA]) ||
+           (sim->reg[ADDRESS_INTERRUPTB] & ~sim->reg[ADDRESS_MASKB] & I_GCRCSENT);
+}
+
+FUSB302_ret_t FUSB302_sim_i2c_read(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count)
+{
+    FUSB302_sim_bus_t *bus = (FUSB302_sim_bus_t *)context;
+    FUSB302_sim_t *sim = sim_find(bus, dev_addr);
+    if (sim == 0) {
+        if (bus) {
+            sim_account(bus, 1);    /* address byte NACKed */
+        }
+        return FUSB302_ERR_READ_DEVICE;
+    }
+    sim_account(bus, count + 3);    /* address + register, repeated start + address, data */
+    FUSB302_sim_update(sim);
+    for (uint8_t i = 0; i < count; i++) {
+        data[i] = sim_reg_read(sim, reg_addr);
+        if (reg_addr != ADDRESS_FIFOS) {
+            reg_addr++;
+        }
+    }
+    return FUSB302_SUCCESS;
+}
+
+FUSB302_ret_t FUSB302_sim_i2c_read_packet(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count)
+{
+    /* One read transaction, the master stops after the length given by the header */
+    FUSB302_sim_bus_t *bus = (FUSB302_sim_bus_t *)context;
+    FUSB302_sim_t *sim = sim_find(bus, dev_addr);
+    if (sim == 0 || count < 3) {
+        if (bus) {
+            sim_account(bus, 1);
+        }
+        return FUSB302_ERR_READ_DEVICE;
+    }
+    FUSB302_sim_update(sim);
+    for (uint8_t i = 0; i < 3; i++) {
+        data[i] = sim_reg_read(sim, reg_addr);
+    }
+    uint8_t len = FUSB302_rx_packet_length(data);
+    if (len > count) {
+        len = count;
+    }
+    for (uint8_t i = 3; i < len; i++) {
+        data[i] = sim_reg_read(sim, reg_addr);
+    }
+    sim_account(bus, len + 3);
+    return FUSB302_SUCCESS;
+}
+
+FUSB302_ret_t FUSB302_sim_i2c_read_async(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count)
+{
+    /* Registers are sampled at submit time, completion is reported after bus time and latency */
+    FUSB302_sim_bus_t *bus = (FUSB302_sim_bus_t *)context;
+    FUSB302_sim_t *sim = sim_find(bus, dev_addr);
+    if (sim == 0 || bus->async_pending) {
+        return FUSB302_ERR_READ_DEVICE;
+    }
+    FUSB302_sim_update(sim);
+    for (uint8_t i = 0; i < count; i++) {
+        data[i] = sim_reg_read(sim, reg_addr);
+        if (reg_addr != ADDRESS_FIFOS) {
+            reg_addr++;
+        }
+    }
+    bus->async_pending = 1;
+    bus->async_done_us = bus->time_us + sim_account_async(bus, count + 3);
+    return FUSB302_SUCCESS;
+}
+
+FUSB302_ret_t FUSB302_sim_i2c_write(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count)
+{
+    FUSB302_sim_bus_t *bus = (FUSB302_sim_bus_t *)context;
+    FUSB302_sim_t *sim = sim_find(bus, dev_addr);
+    if (sim == 0) {
+        if (bus) {
+            sim_account(bus, 1);
+        }
+        return FUSB302_ERR_WRITE_DEVICE;
+    }
+    sim_account(bus, count + 2);    /* address + register, data */
+    FUSB302_sim_update(sim);
+    for (uint8_t i = 0; i < count; i++) {
+        sim_reg_write(sim, reg_addr, data[i]);
+        if (reg_addr != ADDRESS_FIFOS) {
+            reg_addr++;
+        }
+    }
+    FUSB302_sim_update(sim);
+    return FUSB302_SUCCESS;
+}
+
+FUSB302_ret_t FUSB302_sim_delay_ms(uint32_t t)
+{
+    if (sim_bus_selected) {
+        FUSB302_sim_advance(sim_bus_selected, t * 1000);
+    }
+    return FUSB302_SUCCESS;
+}
+
+uint32_t FUSB302_sim_clock_us(void)
+{
+    return sim_bus_selected ? sim_bus_selected->time_us : 0;
+}
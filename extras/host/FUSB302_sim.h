@@ -0,0 +1,126 @@
+
+/**
+ * FUSB302_sim.h
+ *
+ * Register level FUSB302 model for host (Linux) builds
+ * Plugs into the i2c_read / i2c_write / delay_ms callbacks of FUSB302_dev_t, with the bus as
+ * context, so FUSB302_UFP.cpp runs unmodified against it. Several devices can share one bus.
+ *
+ * Modelled:
+ * - R/W register file 01h...0Fh with reset defaults, SW_RES and PD_RESET
+ * - STATUS0A...INTERRUPT, clear-on-read interrupt registers and INT pin
+ * - VBUSOK (needs the measure block), BC_LVL on the measured CC pin
+ * - Wake detection with WAKE_EN, STATUS0 WAKE and I_WAKE
+ * - TX FIFO token stream (SOP, PACKSYM, JAM_CRC, EOP, TXOFF, TXON / TX_START)
+ * - RX FIFO (SOP token, header, data objects, CRC)
+ * - AUTO_CRC GoodCRC reply, I_GCRCSENT, I_TXSENT, I_RETRYFAIL, I_HARDSENT
+ * - Virtual time and I2C bus cost (transactions, bytes, bus time)
+ * - Split-phase transport with per transaction latency, for FUSB302_ASYNC
+ *
+ */
+
+#ifndef FUSB302_SIM_H
+#define FUSB302_SIM_H
+
+#include <stdint.h>
+
+#include "FUSB302_UFP.h"
+
+#define FUSB302_SIM_MAX_DEVICES     8
+#define FUSB302_SIM_RX_FIFO_SIZE    80
+#define FUSB302_SIM_TX_FIFO_SIZE    48
+
+struct FUSB302_sim_s;
+
+/* Result of FUSB302_sim_receive() */
+enum FUSB302_sim_rx_t {
+    FUSB302_SIM_RX_DROPPED = 0,     /* receiver off, other CC pin or RX FIFO full */
+    FUSB302_SIM_RX_STORED,          /* in the RX FIFO without GoodCRC, AUTO_CRC or oscillator off */
+    FUSB302_SIM_RX_GOOD_CRC         /* in the RX FIFO and answered with GoodCRC */
+};
+
+typedef struct {
+    uint32_t transactions;
+    uint32_t bytes;
+    uint32_t bus_time_us;
+    uint32_t blocked_us;            /* time the caller waited in blocking transfers */
+} FUSB302_sim_stats_t;
+
+typedef struct {
+    uint32_t time_us;               /* Virtual time, advanced by bus traffic and delay_ms */
+    uint32_t clock_hz;              /* SCL frequency */
+    uint32_t latency_us;            /* transport overhead per transaction, e.g. driver or DMA setup */
+    FUSB302_sim_stats_t stats;
+
+    /* Split-phase read in flight, on_async_done is called from FUSB302_sim_advance at async_done_us */
+    void (*on_async_done)(void *context, FUSB302_ret_t ret);
+    void *async_context;
+    uint8_t async_pending;
+    uint32_t async_done_us;
+    struct FUSB302_sim_s *device[FUSB302_SIM_MAX_DEVICES];
+} FUSB302_sim_bus_t;
+
+typedef struct FUSB302_sim_s {
+    FUSB302_sim_bus_t *bus;
+    uint8_t address;
+
+    uint8_t reg[0x43];              /* register file, FIFOS at 43h is handled separately */
+    uint8_t rx_fifo[FUSB302_SIM_RX_FIFO_SIZE];
+    uint8_t rx_read;
+    uint8_t rx_count;
+    uint8_t tx_fifo[FUSB302_SIM_TX_FIFO_SIZE];
+    uint8_t tx_count;
+    uint8_t tx_busy;                /* a packet is on the wire, completes at tx_done_us */
+    uint32_t tx_done_us;
+    uint16_t tx_header;
+    uint32_t tx_obj[7];
+
+    /* Partner model, set through FUSB302_sim_set_* */
+    uint8_t vbus;                   /* VBUS present */
+    uint8_t rp_cc;                  /* CC pin with Rp: 0 = none, 1 = CC1, 2 = CC2 */
+    uint8_t rp_level;               /* BC_LVL seen on the Rp pin */
+    uint8_t bc_lvl_glitch;          /* Next n STATUS0 reads alternate between BC_LVL and a wrong level */
+    uint8_t partner_ack;            /* Partner answers transmitted packets with GoodCRC */
+    uint8_t last_bc_lvl;
+    uint8_t last_vbusok;
+    uint8_t last_wake;
+    uint32_t last_update_us;
+
+    /* Partner callbacks, called when a packet or hard reset leaves the chip */
+    void (*on_tx)(struct FUSB302_sim_s *sim, uint16_t header, const uint32_t *obj);
+    void (*on_hard_reset)(struct FUSB302_sim_s *sim);
+    void *partner;
+
+    /* Counters */
+    uint32_t tx_packets;
+    uint32_t rx_packets;
+    uint32_t rx_dropped;
+    uint32_t hard_resets;
+    uint32_t low_power_us;          /* time with only the bandgap and wake circuit powered */
+} FUSB302_sim_t;
+
+/* Bus */
+void FUSB302_sim_bus_init(FUSB302_sim_bus_t *bus, uint32_t clock_hz);
+void FUSB302_sim_bus_select(FUSB302_sim_bus_t *bus);    /* bus used by delay_ms and clock_us */
+FUSB302_sim_bus_t * FUSB302_sim_bus_selected(void);
+void FUSB302_sim_advance(FUSB302_sim_bus_t *bus, uint32_t us);
+static inline uint32_t FUSB302_sim_time_us(FUSB302_sim_bus_t *bus) { return bus->time_us; }
+
+/* Device */
+void FUSB302_sim_init(FUSB302_sim_t *sim, FUSB302_sim_bus_t *bus, uint8_t address);
+void FUSB302_sim_set_vbus(FUSB302_sim_t *sim, uint8_t present);
+void FUSB302_sim_set_rp(FUSB302_sim_t *sim, uint8_t cc, uint8_t level);
+enum FUSB302_sim_rx_t FUSB302_sim_receive(FUSB302_sim_t *sim, uint16_t header, const uint32_t *obj);
+void FUSB302_sim_receive_hard_reset(FUSB302_sim_t *sim);
+void FUSB302_sim_update(FUSB302_sim_t *sim);
+bool FUSB302_sim_int_asserted(FUSB302_sim_t *sim);
+
+/* FUSB302_dev_t callbacks, context is the FUSB302_sim_bus_t. delay_ms and clock_us use the selected bus */
+FUSB302_ret_t FUSB302_sim_i2c_read(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
+FUSB302_ret_t FUSB302_sim_i2c_read_packet(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
+FUSB302_ret_t FUSB302_sim_i2c_read_async(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
+FUSB302_ret_t FUSB302_sim_i2c_write(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
+FUSB302_ret_t FUSB302_sim_delay_ms(uint32_t t);
+uint32_t FUSB302_sim_clock_us(void);
+
+#endif /* FUSB302_SIM_H */
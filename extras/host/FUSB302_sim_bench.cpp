@@ -0,0 +1,215 @@
+
+/**
+ * FUSB302_sim_bench.cpp
+ *
+ * Host benchmark: I2C cost of FUSB302 driver phases against FUSB302_sim
+ * Reports transactions, bytes, I2C bus time and virtual time per phase:
+ * init, idle poll, 1s detached, attach and a fixed 20V negotiation.
+ * Options:
+ *   --packet-read      read RX packets through i2c_read_packet
+ *   --latency=us       transport latency per I2C transaction
+ *   --async            alert through FUSB302_alert_async (build with -DFUSB302_ASYNC),
+ *                      blocked_us shows the time the caller waits on the bus
+ *   --low-power        low power idle, attach starts from I_WAKE
+ * Build with -DFUSB302_STATS to add the driver's per entry point statistics.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FUSB302_UFP.h"
+#include "PD_UFP_Protocol.h"
+#include "FUSB302_sim.h"
+
+#define SIM_I2C_ADDRESS     0x22
+
+static FUSB302_sim_bus_t bus;
+static FUSB302_sim_t sim;
+static FUSB302_dev_t dev;
+static PD_protocol_t protocol;
+static uint8_t source_message_id;
+#if defined(FUSB302_ASYNC)
+static bool use_async;
+#endif
+
+static uint16_t source_header(uint8_t type, uint8_t num_of_obj)
+{
+    uint16_t h = type | (2 << 6) | (1 << 5) | (1 << 8) | ((uint16_t)source_message_id << 9) | ((uint16_t)num_of_obj << 12);
+    source_message_id = (source_message_id + 1) & 0x7;
+    return h;
+}
+
+static void phase_print(const char * name, FUSB302_sim_stats_t * start, uint32_t t_start)
+{
+    printf("%-12s %6u %6u %8u %10u %8u\n", name,
+        (unsigned)(bus.stats.transactions - start->transactions),
+        (unsigned)(bus.stats.bytes - start->bytes),
+        (unsigned)(bus.stats.bus_time_us - start->bus_time_us),
+        (unsigned)(bus.stats.blocked_us - start->blocked_us),
+        (unsigned)(bus.time_us - t_start));
+    *start = bus.stats;
+}
+
+#if defined(FUSB302_ASYNC)
+static void i2c_done(void *context, FUSB302_ret_t ret)
+{
+    FUSB302_i2c_done((FUSB302_dev_t *)context, ret);
+}
+#endif
+
+static void alert(FUSB302_event_t * events)
+{
+#if defined(FUSB302_ASYNC)
+    if (use_async) {
+        while (FUSB302_alert_async(&dev, events) == FUSB302_BUSY) {
+            FUSB302_sim_advance(&bus, 10);  /* caller is free while the transfer runs */
+        }
+        return;
+    }
+#endif
+    FUSB302_alert(&dev, events);
+}
+
+/* Run alert as PD_UFP_c::run() would on INT, respond to received messages */
+static FUSB302_event_t service(void)
+{
+    FUSB302_event_t events = 0;
+    alert(&events);
+    if (events & FUSB302_EVENT_RX_SOP) {
+        uint16_t header;
+        uint32_t obj[7];
+        PD_protocol_event_t protocol_events = 0;
+        while (FUSB302_get_message(&dev, &header, obj) == FUSB302_SUCCESS) {
+            PD_protocol_handle_msg(&protocol, header, obj, &protocol_events);
+        }
+    }
+    if (events & FUSB302_EVENT_GOOD_CRC_SENT) {
+        uint16_t header;
+        uint32_t obj[7];
+        if (PD_protocol_respond(&protocol, &header, obj)) {
+            FUSB302_tx_sop(&dev, header, obj);
+        }
+    }
+    return events;
+}
+
+int main(int argc, char *argv[])
+{
+    FUSB302_sim_stats_t start;
+    uint32_t t_start;
+    FUSB302_event_t events;
+    bool low_power = false;
+
+    FUSB302_sim_bus_init(&bus, 100000);
+    FUSB302_sim_bus_select(&bus);
+    FUSB302_sim_init(&sim, &bus, SIM_I2C_ADDRESS);
+
+    memset(&dev, 0, sizeof(dev));
+    dev.i2c_address = SIM_I2C_ADDRESS;
+    dev.context = &bus;
+    dev.i2c_read = FUSB302_sim_i2c_read;
+    dev.i2c_write = FUSB302_sim_i2c_write;
+    dev.delay_ms = FUSB302_sim_delay_ms;
+    dev.clock_us = FUSB302_sim_clock_us;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--packet-read") == 0) {
+            dev.i2c_read_packet = FUSB302_sim_i2c_read_packet;
+        } else if (strcmp(argv[i], "--low-power") == 0) {
+            low_power = true;
+        } else if (strncmp(argv[i], "--latency=", 10) == 0) {
+            bus.latency_us = strtoul(argv[i] + 10, 0, 10);
+        } else if (strcmp(argv[i], "--async") == 0) {
+#if defined(FUSB302_ASYNC)
+            use_async = true;
+            dev.i2c_read_async = FUSB302_sim_i2c_read_async;
+            bus.on_async_done = i2c_done;
+            bus.async_context = &dev;
+#else
+            printf("--async requires -DFUSB302_ASYNC\n");
+            return 1;
+#endif
+        } else {
+            printf("unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    PD_protocol_init(&protocol);
+    PD_protocol_set_power_option(&protocol, PD_POWER_OPTION_MAX_20V);
+
+    printf("%-12s %6s %6s %8s %10s %8s\n", "phase", "xfers", "bytes", "bus_us", "blocked_us", "time_us");
+    start = bus.stats;
+    t_start = bus.time_us;
+
+    if (FUSB302_init(&dev) != FUSB302_SUCCESS) {
+        printf("init failed: %s\n", FUSB302_get_last_err_msg(&dev));
+        return 1;
+    }
+    if (low_power) {
+        FUSB302_set_low_power(&dev, 1);
+    }
+    phase_print("init", &start, t_start);
+
+    t_start = bus.time_us;
+    service();
+    phase_print("idle_poll", &start, t_start);
+
+    /* 1s detached, alerts only on INT or due timer */
+    t_start = bus.time_us;
+    uint32_t idle_low_power_us = sim.low_power_us;
+    while (bus.time_us - t_start < 1000000) {
+        if (FUSB302_sim_int_asserted(&sim) || FUSB302_timer_due(&dev)) {
+            service();
+        }
+        FUSB302_sim_advance(&bus, 100);
+    }
+    idle_low_power_us = sim.low_power_us - idle_low_power_us;
+    phase_print("idle_1s", &start, t_start);
+
+    t_start = bus.time_us;
+    FUSB302_sim_set_rp(&sim, 1, 3);
+    FUSB302_sim_set_vbus(&sim, 1);
+    for (;;) {
+        /* alert on INT or due timer, as PD_UFP_c::run() does */
+        if ((FUSB302_sim_int_asserted(&sim) || FUSB302_timer_due(&dev)) && (service() & FUSB302_EVENT_ATTACHED)) {
+            break;
+        }
+        FUSB302_sim_advance(&bus, 100);     /* application main loop between alerts */
+    }
+    PD_protocol_reset(&protocol);
+    phase_print("attach", &start, t_start);
+
+    /* Source_Capabilities: 5V 3A, 9V 3A, 15V 3A, 20V 2.25A, PPS 3.3-11V 3A */
+    uint32_t src_cap[5] = {
+        (100UL << 10) | 300, (180UL << 10) | 300, (300UL << 10) | 300, (400UL << 10) | 225,
+        (3UL << 30) | (110UL << 17) | (33UL << 8) | 60
+    };
+    t_start = bus.time_us;
+    FUSB302_sim_receive(&sim, source_header(0x1, 5), src_cap);
+    service();                          /* Src_Cap, GoodCRC sent, Request */
+    FUSB302_sim_advance(&bus, 2000);
+    service();                          /* GoodCRC for Request, TX_SUCCESS */
+    FUSB302_sim_receive(&sim, source_header(0x3, 0), 0);
+    service();                          /* Accept */
+    FUSB302_sim_advance(&bus, 30000);
+    FUSB302_sim_receive(&sim, source_header(0x6, 0), 0);
+    events = service();                 /* PS_RDY */
+    phase_print("negotiation", &start, t_start);
+
+    printf("# tx_packets=%u rx_packets=%u rx_dropped=%u selected_pdo=%u last_events=0x%02X idle_low_power_us=%u\n",
+        (unsigned)sim.tx_packets, (unsigned)sim.rx_packets, (unsigned)sim.rx_dropped,
+        (unsigned)PD_protocol_get_selected_power(&protocol), events, (unsigned)idle_low_power_us);
+
+#if defined(FUSB302_STATS)
+    const char * entry_name[FUSB302_STATS_COUNT] = {"other", "init", "alert", "tx_sop", "read_cc_lvl"};
+    printf("\n%-12s %6s %6s %6s %8s\n", "entry", "calls", "xfers", "bytes", "time_us");
+    for (uint8_t i = 0; i < FUSB302_STATS_COUNT; i++) {
+        const FUSB302_stats_t * s = FUSB302_get_stats(&dev, i);
+        printf("%-12s %6u %6u %6u %8u\n", entry_name[i], (unsigned)s->calls,
+            (unsigned)s->transactions, (unsigned)s->bytes, (unsigned)s->time_us);
+    }
+#endif
+    return 0;
+}
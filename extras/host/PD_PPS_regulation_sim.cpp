@@ -0,0 +1,167 @@
+/**
+ * PD_PPS_regulation_sim.cpp
+ *
+ * Host simulation: closed-loop PPS (PD_protocol_regulate_PPS) against a PPS source with set point offset,
+ * 20mV / 50mA PPS_Status resolution, a cable resistance and a resistive load.
+ * Runs the protocol engine message by message: Source_Capabilities, Request, PPS_Status.
+ * Each loop iteration takes t_PPSRegulate, plus message and tPpsSrcTransSmall time when a Request is sent,
+ * as PD_UFP_c does. Reports per case the open-loop load voltage error, the closed-loop steady-state
+ * error, the number of Requests and the time until the last Request (convergence).
+ * Cases that need a voltage outside the 3.3V ... 21V APDO are marked apdo_limit and left out of worst_error_mv.
+ * Options:
+ *   --offset=mV        source set point offset, default -60
+ *   --cable-error=%    error of the cable resistance given to the sink, default 0
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "PD_UFP_Protocol.h"
+
+#if !PD_UFP_PPS_STATUS
+#error "PD_PPS_regulation_sim requires PD_UFP_PPS and PD_UFP_EXT_MSG"
+#endif
+
+#define T_PPS_REGULATE      PD_UFP_T_PPS_REGULATE
+#define T_MESSAGE           5       /* ms, message and response time */
+#define T_PPS_TRANS_SMALL   25      /* ms, tPpsSrcTransSmall */
+#define MAX_ITERATIONS      100
+
+static PD_protocol_t protocol;
+static uint8_t source_message_id;
+
+static uint16_t source_header(uint8_t type, uint8_t num_of_obj, bool extended)
+{
+    uint16_t h = type | (2 << 6) | (1 << 8) | ((uint16_t)source_message_id << 9) | ((uint16_t)num_of_obj << 12) |
+                 (extended ? (1 << 15) : 0);
+    source_message_id = (source_message_id + 1) & 0x7;
+    return h;
+}
+
+static void source_send_caps(void)
+{
+    /* 5V 3A fixed, PPS 3.3V ... 21V 3A */
+    uint32_t obj[2] = {
+        ((uint32_t)PD_PDO_TYPE_FIXED_SUPPLY << 30) | (100UL << 10) | 300,
+        ((uint32_t)PD_PDO_TYPE_AUGMENTED_PDO << 30) | (210UL << 17) | (33UL << 8) | 60,
+    };
+    PD_protocol_handle_msg(&protocol, source_header(0x1, 2, false), obj, 0);
+}
+
+static void source_send_PPS_status(double v_out, double i_out, PD_protocol_event_t * events)
+{
+    /* Reference: 6.5.10 PPS_Status Message, 2-byte Extended Message Header, 4-byte PPSSDB */
+    uint16_t v = (uint16_t)lround(v_out / 0.02);
+    uint8_t i = (uint8_t)lround(i_out / 0.05);
+    uint32_t obj[2];
+    obj[0] = 4 | (1UL << 15) | ((uint32_t)(v & 0xFF) << 16) | ((uint32_t)(v >> 8) << 24);
+    obj[1] = i | ((uint32_t)PPS_PTF_NORMAL << 9);
+    PD_protocol_handle_msg(&protocol, source_header(0xC, 2, true), obj, events);
+}
+
+static double request_voltage(void)
+{
+    uint16_t header;
+    uint32_t obj;
+    PD_protocol_create_request(&protocol, &header, &obj);
+    return ((obj >> 9) & 0x7FF) * 0.02;   /* B19...9 Output Voltage in 20mV units */
+}
+
+typedef struct {
+    double open_loop_mv;
+    double error_mv;
+    uint16_t requests;
+    uint32_t settle_ms;
+    bool settled;
+    bool limited;       /* request held at the APDO voltage range */
+} result_t;
+
+static void run_case(double target, double i_load, double r_cable, double offset, double cable_error, result_t * r)
+{
+    /* Resistive load, draws i_load at the target voltage */
+    double r_load = target / i_load;
+    uint16_t cable_mohm = (uint16_t)lround(r_cable * 1000 * (1 + cable_error));
+    uint32_t t = 0, last_change = 0;
+    double v_set, v_out, i_out, v_load;
+
+    PD_protocol_init(&protocol);
+    source_message_id = 0;
+    source_send_caps();
+    PD_protocol_set_PPS(&protocol, (uint16_t)lround(target / 0.02), PPS_A(3.0), true);
+    v_set = request_voltage();
+
+    memset(r, 0, sizeof(*r));
+    for (uint16_t n = 0; n < MAX_ITERATIONS; n++) {
+        PD_protocol_event_t events = 0;
+        v_out = v_set + offset;
+        i_out = v_out / (r_load + r_cable);
+        v_load = v_out - i_out * r_cable;
+        if (n == 0) {
+            r->open_loop_mv = (v_load - target) * 1000;
+        }
+        t += T_PPS_REGULATE;
+        source_send_PPS_status(v_out, i_out, &events);
+        if ((events & PD_PROTOCOL_EVENT_PPS_STATUS) &&
+            PD_protocol_regulate_PPS(&protocol, (uint16_t)lround(target / 0.02), cable_mohm, PD_UFP_PPS_REGULATE_STEP)) {
+            v_set = request_voltage();
+            t += 2 * T_MESSAGE + T_PPS_TRANS_SMALL;     /* Request, Accept, transition, PS_RDY */
+            last_change = t;
+            r->requests++;
+        } else if (n > r->requests + 2) {
+            r->settled = true;  /* three polls without a change */
+            break;
+        }
+    }
+    r->error_mv = (v_load - target) * 1000;
+    r->settle_ms = last_change;
+    r->limited = (v_set >= 21.0 - 0.001 || v_set <= 3.3 + 0.001) && fabs(r->error_mv) > 20;
+}
+
+int main(int argc, char *argv[])
+{
+    const double targets[] = {3.3, 5.0, 9.0, 12.0, 20.0};
+    const double currents[] = {0.5, 1.0, 2.0, 3.0};
+    const double cables[] = {0.0, 0.05, 0.1, 0.2, 0.3, 0.5};
+    double offset = -0.06, cable_error = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--offset=", 9) == 0) {
+            offset = atof(argv[i] + 9) / 1000;
+        } else if (strncmp(argv[i], "--cable-error=", 14) == 0) {
+            cable_error = atof(argv[i] + 14) / 100;
+        } else {
+            printf("unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    double worst_error = 0, sum_settle = 0;
+    uint32_t worst_settle = 0, cases = 0, unsettled = 0, limited = 0;
+    printf("%-8s %6s %6s %10s %9s %8s %9s\n", "target_v", "load_a", "cable", "open_mv", "error_mv", "requests", "settle_ms");
+    for (unsigned a = 0; a < sizeof(targets) / sizeof(targets[0]); a++) {
+        for (unsigned b = 0; b < sizeof(currents) / sizeof(currents[0]); b++) {
+            for (unsigned c = 0; c < sizeof(cables) / sizeof(cables[0]); c++) {
+                result_t r;
+                run_case(targets[a], currents[b], cables[c], offset, cable_error, &r);
+                printf("%-8.1f %6.1f %6.2f %10.0f %9.0f %8u %9u%s%s\n", targets[a], currents[b], cables[c],
+                    r.open_loop_mv, r.error_mv, r.requests, (unsigned)r.settle_ms, r.settled ? "" : " unsettled",
+                    r.limited ? " apdo_limit" : "");
+                if (!r.limited) {
+                    worst_error = fabs(r.error_mv) > worst_error ? fabs(r.error_mv) : worst_error;
+                } else {
+                    limited++;
+                }
+                worst_settle = r.settle_ms > worst_settle ? r.settle_ms : worst_settle;
+                sum_settle += r.settle_ms;
+                unsettled += !r.settled;
+                cases++;
+            }
+        }
+    }
+    printf("# cases=%u unsettled=%u apdo_limit=%u worst_error_mv=%.0f mean_settle_ms=%.0f worst_settle_ms=%u offset_mv=%.0f cable_error=%.0f%%\n",
+        (unsigned)cases, (unsigned)unsettled, (unsigned)limited, worst_error, sum_settle / cases, (unsigned)worst_settle,
+        offset * 1000, cable_error * 100);
+    return unsettled ? 1 : 0;
+}
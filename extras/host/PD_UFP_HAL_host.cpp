@@ -0,0 +1,55 @@
+/**
+ * PD_UFP_HAL_host.cpp
+ *
+ * PD_UFP_HAL_t on FUSB302_sim for Linux builds, see PD_UFP_HAL_host.h
+ *
+ */
+
+#include "PD_UFP_HAL_host.h"
+
+uint8_t (*PD_UFP_HAL_host_pin_read)(uint8_t pin);
+
+static FUSB302_ret_t host_i2c_read(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count)
+{
+    return FUSB302_sim_i2c_read(context ? context : FUSB302_sim_bus_selected(), dev_addr, reg_addr, data, count);
+}
+
+static FUSB302_ret_t host_i2c_write(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count)
+{
+    return FUSB302_sim_i2c_write(context ? context : FUSB302_sim_bus_selected(), dev_addr, reg_addr, data, count);
+}
+
+static void host_pin_init(uint8_t pin)
+{
+}
+
+static uint8_t host_pin_read(uint8_t pin)
+{
+    return PD_UFP_HAL_host_pin_read ? PD_UFP_HAL_host_pin_read(pin) : 1;
+}
+
+static uint32_t host_clock_ms(void)
+{
+    /* Bus time is 32-bit us, runs longer than 71 minutes are out of scope */
+    return FUSB302_sim_clock_us() / 1000;
+}
+
+static uint32_t host_clock_us(void)
+{
+    return FUSB302_sim_clock_us();
+}
+
+static void host_delay_ms(uint32_t ms)
+{
+    FUSB302_sim_delay_ms(ms);
+}
+
+const PD_UFP_HAL_t PD_UFP_HAL_host = {
+    host_i2c_read,
+    host_i2c_write,
+    host_pin_init,
+    host_pin_read,
+    host_clock_ms,
+    host_clock_us,
+    host_delay_ms,
+};
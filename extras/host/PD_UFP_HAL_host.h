@@ -0,0 +1,23 @@
+/**
+ * PD_UFP_HAL_host.h
+ *
+ * PD_UFP_HAL_t for Linux builds of PD_UFP_c against FUSB302_sim, in virtual time.
+ * The I2C context of a port is its FUSB302_sim_bus_t, 0 for the selected bus. Time and delay run on
+ * the selected bus, so a delay advances the simulation instead of sleeping.
+ * pin_read calls PD_UFP_HAL_host_pin_read, e.g. FUSB302_sim_int_asserted() ? 0 : 1, no hook reads 1.
+ * Usage: PD_UFP_c::set_hal(PD_UFP_HAL_host); port.set_i2c(&bus, address); port.init(pin, ...)
+ *
+ */
+
+#ifndef PD_UFP_HAL_HOST_H
+#define PD_UFP_HAL_HOST_H
+
+#include <stdint.h>
+
+#include "PD_UFP_HAL.h"
+#include "FUSB302_sim.h"
+
+extern const PD_UFP_HAL_t PD_UFP_HAL_host;
+extern uint8_t (*PD_UFP_HAL_host_pin_read)(uint8_t pin);
+
+#endif /* PD_UFP_HAL_HOST_H */
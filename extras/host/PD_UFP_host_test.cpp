@@ -0,0 +1,381 @@
+/**
+ * PD_UFP_host_test.cpp
+ *
+ * Host regression tests: PD_UFP_c against PD_source_sim on FUSB302_sim in virtual time.
+ * Each test runs the sink through a scripted exchange and checks the power it reports and
+ * the messages on the wire. Prints one line per failed check, exit code 1 on failure.
+ * Option: name prefix of the tests to run
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "PD_UFP.h"
+#include "FUSB302_sim.h"
+#include "PD_UFP_HAL_host.h"
+#include "PD_source_sim.h"
+
+#define SIM_I2C_ADDRESS     0x22
+#define T_STEP_US           100         /* application main loop */
+
+static FUSB302_sim_bus_t bus;
+static FUSB302_sim_t sim;
+static PD_source_sim_t source;
+static uint32_t checks, failed;
+
+#define CHECK(cond) do { \
+    checks++; \
+    if (!(cond)) { \
+        failed++; \
+        printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+    } \
+} while (0)
+
+static uint8_t int_pin_read(uint8_t pin)
+{
+    return FUSB302_sim_int_asserted(&sim) ? 0 : 1;
+}
+
+/* 5V 3A, 9V 3A, 20V 2.25A, Source_Capabilities right after VBUS */
+static void source_profile(PD_source_profile_t *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->rp_level = 3;
+    p->pdo[p->num_of_pdo++] = (100UL << 10) | 300;
+    p->pdo[p->num_of_pdo++] = (180UL << 10) | 300;
+    p->pdo[p->num_of_pdo++] = (400UL << 10) | 225;
+    p->t_vbus_us = 20000;
+    p->t_first_src_cap_us = 100000;
+    p->t_src_cap_us = 150000;
+    p->src_cap_count = 50;
+    p->t_response_us = 5000;
+    p->t_transition_us = 100000;
+    p->t_pps_transition_us = 10000;
+    p->t_hard_reset_us = 30000;
+    p->t_src_recover_us = 900000;
+}
+
+static void sim_start(const PD_source_profile_t *profile)
+{
+    FUSB302_sim_bus_init(&bus, 400000);
+    FUSB302_sim_bus_select(&bus);
+    FUSB302_sim_init(&sim, &bus, SIM_I2C_ADDRESS);
+    PD_source_sim_init(&source, &sim, profile);
+}
+
+static void partner_receive(uint8_t type, uint8_t id, uint8_t num_of_obj, const uint32_t *obj)
+{
+    /* Message from the source side, outside of PD_source_sim */
+    uint16_t header = type | (2 << 6) | (1 << 5) | (1 << 8) | ((uint16_t)id << 9) | ((uint16_t)num_of_obj << 12);
+    FUSB302_sim_receive(&sim, header, obj);
+}
+
+static void run_us(PD_UFP_c & pd, uint32_t us)
+{
+    for (uint32_t t0 = bus.time_us; bus.time_us - t0 < us; ) {
+        pd.run();
+        FUSB302_sim_advance(&bus, T_STEP_US);
+        PD_source_sim_update(&source);
+    }
+}
+
+static void run_ms(PD_UFP_c & pd, uint32_t ms)
+{
+    run_us(pd, ms * 1000);
+}
+
+/* Messages from the sink with GoodCRC, passed on to PD_source_sim if it is set up */
+static uint32_t sink_requests, sink_caps;
+static void (*source_on_tx)(FUSB302_sim_t *sim, uint16_t header, const uint32_t *obj);
+
+static void sink_tx(FUSB302_sim_t *s, uint16_t header, const uint32_t *obj)
+{
+    uint16_t type = header & 0x801F;
+    if ((header >> 12) && type == 0x2) {
+        sink_requests++;
+    } else if ((header >> 12) && type == 0x4) {
+        sink_caps++;
+    }
+    if (source_on_tx) {
+        source_on_tx(s, header, obj);
+    }
+}
+
+static void sink_tx_count(bool to_source)
+{
+    sink_requests = 0;
+    sink_caps = 0;
+    source_on_tx = to_source ? sim.on_tx : 0;
+    sim.on_tx = sink_tx;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Reject
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void test_reject_without_contract(void)
+{
+    /* First Request rejected: no explicit contract, the sink stays at vSafe5V */
+    PD_source_profile_t profile;
+    source_profile(&profile);
+    profile.reject_count = 1;
+    sim_start(&profile);
+    PD_UFP_c pd;
+    pd.set_i2c(&bus, SIM_I2C_ADDRESS);
+    pd.init(0, PD_POWER_OPTION_MAX_20V);
+    PD_source_sim_attach(&source, 1);
+    run_ms(pd, 1000);
+    CHECK(source.stats.rejects == 1);
+    CHECK(!source.contract);
+    CHECK(pd.is_power_ready());
+    CHECK(pd.get_voltage() == PD_V(5));
+    CHECK(!pd.is_ps_transition());
+}
+
+static void test_reject_keeps_contract(void)
+{
+    /* Request for a new voltage rejected: the 20V contract stays */
+    PD_source_profile_t profile;
+    source_profile(&profile);
+    sim_start(&profile);
+    PD_UFP_c pd;
+    pd.set_i2c(&bus, SIM_I2C_ADDRESS);
+    pd.init(0, PD_POWER_OPTION_MAX_20V);
+    PD_source_sim_attach(&source, 1);
+    run_ms(pd, 1000);
+    CHECK(source.contract && source.output_mv == 20000);
+    CHECK(pd.is_power_ready() && pd.get_voltage() == PD_V(20));
+
+    source.reject_left = 1;
+    pd.set_power_option(PD_POWER_OPTION_MAX_9V);
+    run_ms(pd, 500);
+    CHECK(source.stats.rejects == 1);
+    CHECK(source.output_mv == 20000);
+    CHECK(pd.is_power_ready() && pd.get_voltage() == PD_V(20));
+    CHECK(!pd.is_ps_transition());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// PPS
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void test_pps_keepalive_rejected(void)
+{
+    /* Rejected keepalive: the PPS contract stays, the next keepalive follows t_PPSRequest later */
+    PD_source_profile_t profile;
+    source_profile(&profile);
+    profile.pdo[profile.num_of_pdo++] = (3UL << 30) | (110UL << 17) | (33UL << 8) | 60;     /* 3.3V ... 11V 3A */
+    sim_start(&profile);
+    PD_UFP_c pd;
+    pd.set_i2c(&bus, SIM_I2C_ADDRESS);
+    pd.init_PPS(0, PPS_V(9.0), PPS_A(2.0));
+    PD_source_sim_attach(&source, 1);
+    run_ms(pd, 1000);
+    CHECK(pd.is_PPS_ready());
+    CHECK(source.output_mv == 9000);
+
+    uint32_t requests = source.stats.requests;
+    source.reject_left = 255;
+    run_ms(pd, PD_UFP_T_PPS_REQUEST + 500);
+    CHECK(source.stats.requests == requests + 1);
+    CHECK(source.stats.rejects == 1);
+    run_ms(pd, PD_UFP_T_PPS_REQUEST);
+    CHECK(source.stats.requests == requests + 2);
+    CHECK(pd.is_PPS_ready());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// TX failed
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void negotiate_20V(PD_UFP_c & pd)
+{
+    PD_source_profile_t profile;
+    source_profile(&profile);
+    sim_start(&profile);
+    pd.set_i2c(&bus, SIM_I2C_ADDRESS);
+    pd.init(0, PD_POWER_OPTION_MAX_20V);
+    PD_source_sim_attach(&source, 1);
+    run_ms(pd, 1000);
+}
+
+static void test_tx_failed_keeps_contract(void)
+{
+    /* Request for a new voltage without GoodCRC: the 20V contract stays, the request is sent again */
+    PD_UFP_c pd;
+    negotiate_20V(pd);
+    CHECK(pd.is_power_ready() && pd.get_voltage() == PD_V(20));
+    uint32_t requests = source.stats.requests;
+
+    sim.partner_ack = 0;
+    pd.set_power_option(PD_POWER_OPTION_MAX_9V);
+    run_ms(pd, 20);
+    CHECK(source.stats.requests == requests);
+    CHECK(pd.is_power_ready() && pd.get_voltage() == PD_V(20));
+
+    sim.partner_ack = 1;
+    run_ms(pd, 500);
+    CHECK(source.stats.requests == requests + 1);
+    CHECK(source.output_mv == 9000);
+    CHECK(pd.is_power_ready() && pd.get_voltage() == PD_V(9));
+}
+
+static void test_tx_failed_other_message(void)
+{
+    /* Sink_Capabilities without GoodCRC while the source switches to 9V: the Request is not affected */
+    PD_UFP_c pd;
+    negotiate_20V(pd);
+    pd.set_power_option(PD_POWER_OPTION_MAX_9V);
+    run_ms(pd, 20);
+    CHECK(source.stats.accepts == 2);
+
+    sim.partner_ack = 0;
+    partner_receive(0x8, source.message_id, 0, 0);     /* Get_Sink_Cap */
+    source.message_id = (source.message_id + 1) & 0x7;
+    run_ms(pd, 20);
+    CHECK(pd.is_ps_transition());
+    CHECK(pd.get_voltage() == PD_V(20));
+
+    sim.partner_ack = 1;
+    run_ms(pd, 200);
+    CHECK(source.output_mv == 9000);
+    CHECK(pd.is_power_ready() && pd.get_voltage() == PD_V(9));
+    CHECK(!pd.is_ps_transition());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// TX, one message at a time
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void test_tx_response_and_request(void)
+{
+    /* Sink_Capabilities response and a new Request due in the same run(): both are sent */
+    PD_UFP_c pd;
+    negotiate_20V(pd);
+    sink_tx_count(true);
+    partner_receive(0x8, source.message_id, 0, 0);     /* Get_Sink_Cap */
+    source.message_id = (source.message_id + 1) & 0x7;
+    run_us(pd, 1800);
+    pd.set_power_option(PD_POWER_OPTION_MAX_9V);
+    run_ms(pd, 300);
+    CHECK(sink_caps == 1);
+    CHECK(sink_requests == 1);
+    CHECK(source.output_mv == 9000);
+    CHECK(pd.is_power_ready() && pd.get_voltage() == PD_V(9));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Hard reset
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void test_hard_reset_received(void)
+{
+    /* Source hard reset in the middle of a negotiation: MessageIDs start over from 0 */
+    PD_source_profile_t profile;
+    source_profile(&profile);
+    sim_start(&profile);
+    sink_tx_count(false);
+    PD_UFP_c pd;
+    pd.set_i2c(&bus, SIM_I2C_ADDRESS);
+    pd.init(0, PD_POWER_OPTION_MAX_20V);
+    FUSB302_sim_set_rp(&sim, 1, profile.rp_level);
+    FUSB302_sim_set_vbus(&sim, 1);
+    run_ms(pd, 100);
+
+    partner_receive(0x1, 0, profile.num_of_pdo, profile.pdo);   /* Source_Capabilities */
+    run_ms(pd, 20);
+    CHECK(sink_requests == 1);
+
+    FUSB302_sim_receive_hard_reset(&sim);
+    run_ms(pd, 20);
+    CHECK(!pd.is_ps_transition());
+
+    partner_receive(0x1, 0, profile.num_of_pdo, profile.pdo);
+    run_ms(pd, 20);
+    CHECK(sink_requests == 2);
+    partner_receive(0x3, 1, 0, 0);                              /* Accept */
+    partner_receive(0x6, 2, 0, 0);                              /* PS_RDY */
+    run_ms(pd, 20);
+    CHECK(pd.is_power_ready() && pd.get_voltage() == PD_V(20));
+}
+
+static void test_detach_before_caps(void)
+{
+    /* Detached while waiting for Source_Capabilities: no Get_Source_Cap or hard reset afterwards */
+    PD_source_profile_t profile;
+    source_profile(&profile);
+    sim_start(&profile);
+    sink_tx_count(false);
+    PD_UFP_c pd;
+    pd.set_i2c(&bus, SIM_I2C_ADDRESS);
+    pd.init(0, PD_POWER_OPTION_MAX_20V);
+    FUSB302_sim_set_rp(&sim, 1, profile.rp_level);
+    FUSB302_sim_set_vbus(&sim, 1);
+    run_ms(pd, 100);
+
+    FUSB302_sim_set_vbus(&sim, 0);
+    FUSB302_sim_set_rp(&sim, 0, 0);
+    run_ms(pd, 5000);
+    CHECK(sim.hard_resets == 0);
+    CHECK(!pd.is_power_ready());
+}
+
+static void test_detach_tx_in_flight(void)
+{
+    /* Detached while Get_Source_Cap is retried: the late RETRYFAIL must not hold INT low */
+    PD_source_profile_t profile;
+    source_profile(&profile);
+    sim_start(&profile);
+    sink_tx_count(false);
+    PD_UFP_c pd;
+    pd.set_i2c(&bus, SIM_I2C_ADDRESS);
+    pd.init(0, PD_POWER_OPTION_MAX_20V);
+    FUSB302_sim_set_rp(&sim, 1, profile.rp_level);
+    FUSB302_sim_set_vbus(&sim, 1);
+    for (uint32_t i = 0; i < 20000 && !sim.tx_busy; i++) {
+        run_us(pd, 100);
+    }
+    CHECK(sim.tx_busy);
+
+    FUSB302_sim_set_vbus(&sim, 0);
+    FUSB302_sim_set_rp(&sim, 0, 0);
+    run_ms(pd, 100);
+    uint32_t transactions = bus.stats.transactions;
+    run_ms(pd, 500);
+    CHECK(!FUSB302_sim_int_asserted(&sim));
+    CHECK(bus.stats.transactions - transactions < 10);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Main
+///////////////////////////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    const char * name;
+    void (*fn)(void);
+} test_t;
+
+static const test_t tests[] = {
+    {"reject.without_contract", test_reject_without_contract},
+    {"reject.keeps_contract", test_reject_keeps_contract},
+    {"pps.keepalive_rejected", test_pps_keepalive_rejected},
+    {"tx_failed.keeps_contract", test_tx_failed_keeps_contract},
+    {"tx_failed.other_message", test_tx_failed_other_message},
+    {"tx.response_and_request", test_tx_response_and_request},
+    {"hard_reset.received", test_hard_reset_received},
+    {"detach.before_caps", test_detach_before_caps},
+    {"detach.tx_in_flight", test_detach_tx_in_flight},
+};
+
+int main(int argc, char *argv[])
+{
+    const char * filter = argc > 1 ? argv[1] : "";
+    uint32_t count = 0;
+    PD_UFP_c::set_hal(PD_UFP_HAL_host);
+    PD_UFP_HAL_host_pin_read = int_pin_read;
+    for (uint32_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        if (strncmp(tests[i].name, filter, strlen(filter)) == 0) {
+            uint32_t f = failed;
+            tests[i].fn();
+            printf("%-32s %s\n", tests[i].name, failed == f ? "ok" : "FAILED");
+            count++;
+        }
+    }
+    printf("# tests=%u checks=%u failed=%u\n", (unsigned)count, (unsigned)checks, (unsigned)failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,211 @@
+/**
+ * PD_UFP_log_decode.cpp
+ *
+ * Host tool: prints the text log of PD_UFP_Log_c from binary log records (print_status_binary,
+ * status_log_read_record). Each record is replayed into a PD_UFP_Log_c and read back with
+ * status_log_readline, so the lines are those print_status would have sent, message names from
+ * PD_protocol_get_msg_name. Bytes outside valid records (line noise, a record cut at the start or
+ * end of the capture) are skipped and counted. Times are deltas, after a lost record the following
+ * times are early by its delta.
+ * Usage: pd_ufp_log_decode [--info] [file], reads stdin without file
+ *   --info             PD_LOG_LEVEL_INFO, default PD_LOG_LEVEL_VERBOSE
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "PD_UFP.h"
+
+#if !PD_UFP_LOG
+#error "PD_UFP_log_decode requires PD_UFP_LOG"
+#endif
+
+static uint16_t get_u16(const uint8_t * p)
+{
+    return p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t * p)
+{
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+class Log_decode_c : public PD_UFP_Log_c
+{
+    public:
+        Log_decode_c(pd_log_level_t log_level): PD_UFP_Log_c(log_level), time(0)
+        {
+            status_log_time[0] = 0;
+        }
+        static bool check(const uint8_t * record, uint8_t length)
+        {
+            return status_log_record_crc(record + 1, length + 1) == record[length + 2];
+        }
+        bool replay(const uint8_t * payload, uint8_t length);
+        void print(FILE * out);
+
+    protected:
+        uint16_t time;
+};
+
+bool Log_decode_c::replay(const uint8_t * payload, uint8_t length)
+{
+    const uint8_t * p = payload, * end = payload + length;
+    uint16_t dt = 0;
+    for (uint8_t shift = 0; ; shift += 7) {
+        if (p == end || shift > 14) {
+            return false;
+        }
+        dt |= (uint16_t)(*p & 0x7F) << shift;
+        if ((*p++ & 0x80) == 0) {
+            break;
+        }
+    }
+    if (p == end) {
+        return false;
+    }
+    status_log_t * log = status_log.back();     /* the log is empty, print() reads every record */
+    uint8_t status = *p++;
+    uint8_t left = end - p;
+    log->msg_header = 0;
+    log->obj_count = 0;
+    switch (status) {
+    case STATUS_LOG_MSG_TX:
+    case STATUS_LOG_MSG_RX:
+        if (left < 2 || (left - 2) % 4 || (left - 2) / 4 > PD_PROTOCOL_MAX_NUM_OF_PDO) {
+            return false;
+        }
+        log->msg_header = get_u16(p);
+        for (p += 2; p < end; p += 4) {
+            status_log_obj.push(get_u32(p));
+            log->obj_count++;
+        }
+        break;
+    case STATUS_LOG_DEV:
+        if (left != 3) {
+            return false;
+        }
+        status_initialized = p[0];
+        FUSB302.reg_control[0] = 0x80 | ((p[1] & 0x7) << 4) | (p[2] & 0xF);   /* DEVICE_ID register */
+        break;
+    case STATUS_LOG_CC:
+        if (left != 2) {
+            return false;
+        }
+        FUSB302.cc1 = p[0];
+        FUSB302.cc2 = p[1];
+        break;
+    case STATUS_LOG_SRC_CAP:
+        if (left < 2 || p[1] > PD_PROTOCOL_MAX_NUM_OF_PDO || left != 2 + p[1] * 4) {
+            return false;
+        }
+        protocol.power_data_obj_selected = p[0];
+        protocol.power_data_obj_count = p[1];
+        for (uint8_t i = 0; i < p[1]; i++) {
+            uint32_t c = get_u32(p + 2 + i * 4);
+            protocol.power_cache[i].type = c >> 30;
+            protocol.power_cache[i].max_v = (c >> 20) & 0x3FF;
+            protocol.power_cache[i].min_v = (c >> 10) & 0x3FF;
+            if (protocol.power_cache[i].type == PD_PDO_TYPE_BATTERY) {
+                /* Current at max voltage, as decoded from the PDO */
+                uint16_t max_v = protocol.power_cache[i].max_v;
+                protocol.power_cache[i].max_p = c & 0x3FF;
+                protocol.power_cache[i].max_i = max_v ? (uint32_t)(c & 0x3FF) * 500 / max_v : 0;
+            } else {
+                protocol.power_cache[i].max_p = 0;
+                protocol.power_cache[i].max_i = c & 0x3FF;
+            }
+        }
+        break;
+    case STATUS_LOG_POWER_READY:
+        if (left != 5) {
+            return false;
+        }
+        status_power = p[0];
+        ready_voltage = get_u16(p + 1);
+        ready_current = get_u16(p + 3);
+        break;
+    case STATUS_LOG_OVERFLOW:
+        if (left != 3) {
+            return false;
+        }
+        log->msg_header = get_u16(p);
+        log->obj_count = p[2];
+        break;
+    default:
+        break;
+    }
+    time += dt;
+    log->time = time;
+    log->status = status;
+    status_log.push();
+    return true;
+}
+
+void Log_decode_c::print(FILE * out)
+{
+    char line[96];
+    while (status_log.count()) {
+        if (status_log_readline(line, sizeof(line) - 1) > 0) {
+            fputs(line, out);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    pd_log_level_t level = PD_LOG_LEVEL_VERBOSE;
+    FILE * in = stdin;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--info") == 0) {
+            level = PD_LOG_LEVEL_INFO;
+        } else if (argv[i][0] == '-' && argv[i][1]) {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        } else if (strcmp(argv[i], "-") != 0 && (in = fopen(argv[i], "rb")) == 0) {
+            fprintf(stderr, "cannot open %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    static Log_decode_c decoder(level);
+    uint8_t buf[4096];
+    uint32_t count = 0, records = 0, skipped = 0, invalid = 0;
+    bool eof = false;
+    while (!eof || count) {
+        if (!eof && count < PD_UFP_LOG_RECORD_MAX) {
+            size_t n = fread(buf + count, 1, sizeof(buf) - count, in);
+            count += n;
+            eof = n == 0;
+            continue;
+        }
+        /* sync, length, payload, crc */
+        uint32_t length = count > 1 ? buf[1] : 0;
+        if (buf[0] != PD_UFP_LOG_RECORD_SYNC || length + 3 > PD_UFP_LOG_RECORD_MAX) {
+            memmove(buf, buf + 1, --count);
+            skipped++;
+            continue;
+        }
+        if (length + 3 > count) {
+            skipped += count;   /* cut at the end of the capture */
+            break;
+        }
+        if (Log_decode_c::check(buf, length) && decoder.replay(buf + 2, length)) {
+            decoder.print(stdout);
+            records++;
+            count -= length + 3;
+            memmove(buf, buf + length + 3, count);
+        } else {
+            invalid++;
+            memmove(buf, buf + 1, --count);
+            skipped++;
+        }
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
+    fprintf(stderr, "# records=%u skipped_bytes=%u invalid_records=%u\n", (unsigned)records, (unsigned)skipped,
+        (unsigned)invalid);
+    return 0;
+}
@@ -0,0 +1,496 @@
+/**
+ * PD_UFP_microbench.cpp
+ *
+ * Host microbenchmarks of the protocol and driver hot paths, ns per call on the host CPU
+ * and I2C traffic per call against FUSB302_sim:
+ *   protocol.handle_msg.ctrl.N / data.N / ext.N   PD_protocol_handle_msg on every message type
+ *   protocol.src_cap.pdos.N        Source_Capabilities with N PDOs, decode and evaluate_src_cap
+ *   protocol.evaluate.pdos.N       evaluate_src_cap alone (PD_protocol_set_power_option) on N PDOs
+ *   protocol.get_power_info        PD_protocol_get_power_info, all positions of 7 PDOs
+ *   fusb302.tx_sop.objs.N          FUSB302_tx_sop with N data objects
+ *   fusb302.alert.*                FUSB302_alert: no interrupt, received control message, Source_Capabilities
+ *   log.readline.*                 PD_UFP_Log_c::status_log_readline per line, requires PD_UFP_LOG
+ *   log.record.*                   PD_UFP_Log_c::status_log_read_record per event, requires PD_UFP_LOG
+ *   log.event.*                    PD_UFP_Log_c::status_log_event, the log producer, requires PD_UFP_LOG
+ * PDO mixes of N = 1 ... 7: 5V, 9V, Variable 5-12V, 15V, Battery 5-20V 60W, PPS 3.3-21V, 20V.
+ * Calls without per-call setup are timed in batches, others one by one less the cost of reading
+ * the clock. Each result is the median and p99 over the samples.
+ * Options:
+ *   --iterations=n     samples per benchmark, default 20000
+ *   --filter=prefix    only benchmarks whose name starts with prefix
+ *   --json             machine readable output, one JSON document on stdout
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "PD_UFP.h"
+#include "FUSB302_sim.h"
+#include "PD_UFP_HAL_host.h"
+
+#define SIM_I2C_ADDRESS     0x22
+#define BATCH               64      /* calls per sample in batch mode */
+#define WARMUP              256
+
+typedef void (*bench_fn_t)(uint32_t n);
+
+typedef struct {
+    char name[40];
+    char label[16];
+    uint32_t samples;
+    double ns_median;
+    double ns_p99;
+    double xfers_per_op;
+    double bytes_per_op;
+} result_t;
+
+static FUSB302_sim_bus_t bus;
+static FUSB302_sim_t sim;
+static FUSB302_dev_t dev;
+static PD_protocol_t protocol;
+static PD_protocol_t protocol_caps;     /* after Source_Capabilities, start state of the message benchmarks */
+
+static uint32_t iterations = 20000;
+static const char * filter = "";
+static bool json = false;
+static uint64_t clock_overhead;
+static uint32_t * sample;
+static result_t results[160];
+static uint32_t result_count;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_u32(const void * a, const void * b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* setup runs untimed before each call, without setup calls are timed in batches */
+static void bench(const char * name, const char * label, bench_fn_t setup, bench_fn_t op)
+{
+    if (strncmp(name, filter, strlen(filter)) != 0 || result_count >= sizeof(results) / sizeof(results[0])) {
+        return;
+    }
+    result_t * r = &results[result_count++];
+    uint64_t xfers = 0, bytes = 0, ops = 0;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < WARMUP; i++, n++) {
+        if (setup) {
+            setup(n);
+        }
+        op(n);
+    }
+    for (uint32_t s = 0; s < iterations; s++) {
+        FUSB302_sim_stats_t start;
+        uint64_t t0, t1;
+        if (setup) {
+            setup(n);
+            start = bus.stats;
+            t0 = now_ns();
+            op(n++);
+            t1 = now_ns();
+            sample[s] = (uint32_t)(t1 - t0 > clock_overhead ? t1 - t0 - clock_overhead : 0) * BATCH;
+            ops += 1;
+        } else {
+            start = bus.stats;
+            t0 = now_ns();
+            for (uint32_t b = 0; b < BATCH; b++) {
+                op(n++);
+            }
+            t1 = now_ns();
+            sample[s] = (uint32_t)(t1 - t0);
+            ops += BATCH;
+        }
+        xfers += bus.stats.transactions - start.transactions;
+        bytes += bus.stats.bytes - start.bytes;
+    }
+    qsort(sample, iterations, sizeof(uint32_t), compare_u32);
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    snprintf(r->label, sizeof(r->label), "%s", label ? label : "");
+    r->samples = iterations;
+    /* samples are in ns per BATCH calls */
+    r->ns_median = (double)sample[(iterations - 1) / 2] / BATCH;
+    r->ns_p99 = (double)sample[(uint32_t)((iterations - 1) * 0.99)] / BATCH;
+    r->xfers_per_op = (double)xfers / ops;
+    r->bytes_per_op = (double)bytes / ops;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Protocol
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static const uint32_t pdo_mix[7] = {
+    (100UL << 10) | 300,                                    /* Fixed 5V 3A */
+    (180UL << 10) | 300,                                    /* Fixed 9V 3A */
+    (2UL << 30) | (240UL << 20) | (100UL << 10) | 200,      /* Variable 5-12V 2A */
+    (300UL << 10) | 300,                                    /* Fixed 15V 3A */
+    (1UL << 30) | (400UL << 20) | (100UL << 10) | 240,      /* Battery 5-20V 60W */
+    (3UL << 30) | (210UL << 17) | (33UL << 8) | 60,         /* PPS 3.3-21V 3A */
+    (400UL << 10) | 225,                                    /* Fixed 20V 2.25A */
+};
+
+static uint16_t msg_header;             /* message of the running benchmark, MessageID from the call */
+static uint32_t msg_obj[7];
+static uint8_t pdo_count;
+
+static uint16_t source_header(uint8_t type, uint8_t num_of_obj, bool extended, uint32_t n)
+{
+    return type | (2 << 6) | (1 << 5) | (1 << 8) | ((uint16_t)(n & 0x7) << 9) | ((uint16_t)num_of_obj << 12) |
+           (extended ? (1 << 15) : 0);
+}
+
+static void protocol_caps_init(uint8_t num_of_pdo)
+{
+    PD_protocol_init(&protocol);
+    PD_protocol_set_power_option(&protocol, PD_POWER_OPTION_MAX_20V);
+    PD_protocol_handle_msg(&protocol, source_header(0x1, num_of_pdo, false, 7), (uint32_t *)pdo_mix, 0);
+}
+
+static void op_handle_msg(uint32_t n)
+{
+    /* New MessageID every call, a repeated one is dropped as a retransmission */
+    PD_protocol_event_t events = 0;
+    PD_protocol_handle_msg(&protocol, msg_header | ((uint16_t)(n & 0x7) << 9), msg_obj, &events);
+}
+
+static void op_evaluate(uint32_t n)
+{
+    PD_protocol_set_power_option(&protocol, (n & 1) ? PD_POWER_OPTION_MAX_20V : PD_POWER_OPTION_MAX_POWER);
+}
+
+static void op_get_power_info(uint32_t n)
+{
+    PD_power_info_t info;
+    PD_protocol_get_power_info(&protocol, n % 7, &info);
+}
+
+static void bench_msg(const char * kind, uint8_t type, uint8_t num_of_obj, bool extended)
+{
+    char name[40], label[16];
+    snprintf(name, sizeof(name), "protocol.handle_msg.%s.%u", kind, type);
+    msg_header = source_header(type, num_of_obj, extended, 0);
+    PD_protocol_get_msg_name(msg_header, label, sizeof(label));
+    protocol = protocol_caps;
+    bench(name, label, 0, op_handle_msg);
+}
+
+static void bench_protocol(void)
+{
+    protocol_caps_init(5);
+    protocol_caps = protocol;
+
+    for (uint8_t t = 0; t < 24; t++) {
+        memset(msg_obj, 0, sizeof(msg_obj));
+        bench_msg("ctrl", t, 0, false);
+    }
+    for (uint8_t t = 0; t < 16; t++) {
+        uint8_t num_of_obj = 1;
+        memset(msg_obj, 0, sizeof(msg_obj));
+        if (t == 0x1) {
+            num_of_obj = 5;
+            memcpy(msg_obj, pdo_mix, 5 * sizeof(uint32_t));
+        } else if (t == 0x3) {
+            msg_obj[0] = 0x5UL << 28;   /* BIST Carrier Mode */
+        } else if (t == 0xF) {
+            msg_obj[0] = 0xFF008001UL;  /* Structured VDM, Discover Identity */
+        }
+        bench_msg("data", t, num_of_obj, false);
+    }
+    for (uint8_t t = 0; t < 16; t++) {
+        /* 2-byte Extended Message Header, chunked, 4 data bytes */
+        memset(msg_obj, 0, sizeof(msg_obj));
+        msg_obj[0] = 4 | (1UL << 15);
+        if (t == 0xC) {
+            msg_obj[0] |= (450UL << 16);    /* PPS_Status 9.0V, 2.0A, PTF normal */
+            msg_obj[1] = 40 | (1UL << 9);
+        }
+        bench_msg("ext", t, 2, true);
+    }
+
+    for (pdo_count = 1; pdo_count <= 7; pdo_count++) {
+        char name[40];
+        snprintf(name, sizeof(name), "protocol.src_cap.pdos.%u", pdo_count);
+        PD_protocol_init(&protocol);
+        PD_protocol_set_power_option(&protocol, PD_POWER_OPTION_MAX_20V);
+        msg_header = source_header(0x1, pdo_count, false, 0);
+        memcpy(msg_obj, pdo_mix, sizeof(pdo_mix));
+        bench(name, 0, 0, op_handle_msg);
+
+        snprintf(name, sizeof(name), "protocol.evaluate.pdos.%u", pdo_count);
+        protocol_caps_init(pdo_count);
+        bench(name, 0, 0, op_evaluate);
+    }
+
+    protocol_caps_init(7);
+    bench("protocol.get_power_info", 0, 0, op_get_power_info);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// FUSB302 driver on FUSB302_sim
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static uint8_t tx_count;
+
+static void drain(void)
+{
+    uint16_t header;
+    uint32_t obj[7];
+    for (uint8_t i = 0; i < 8 && FUSB302_sim_int_asserted(&sim); i++) {
+        FUSB302_event_t events = 0;
+        FUSB302_alert(&dev, &events);
+    }
+    while (FUSB302_get_message(&dev, &header, obj) == FUSB302_SUCCESS) {}
+}
+
+static void op_tx_sop(uint32_t n)
+{
+    uint32_t obj[7] = {pdo_mix[0], 0, 0, 0, 0, 0, 0};
+    FUSB302_tx_sop(&dev, (tx_count ? 0x2 : 0x7) | (2 << 6) | ((uint16_t)(n & 0x7) << 9) | ((uint16_t)tx_count << 12), obj);
+}
+
+static void setup_tx_sop(uint32_t n)
+{
+    /* The sink PHY waits for GoodCRC, let the sim finish the last packet */
+    FUSB302_sim_advance(&bus, 1000);
+    drain();
+}
+
+static void op_alert(uint32_t n)
+{
+    FUSB302_event_t events = 0;
+    FUSB302_alert(&dev, &events);
+}
+
+static void setup_alert_ctrl(uint32_t n)
+{
+    drain();
+    FUSB302_sim_receive(&sim, source_header(0x6, 0, false, n), 0);     /* PS_RDY */
+}
+
+static void setup_alert_src_cap(uint32_t n)
+{
+    drain();
+    FUSB302_sim_receive(&sim, source_header(0x1, 7, false, n), pdo_mix);
+}
+
+static void bench_fusb302(void)
+{
+    FUSB302_sim_bus_init(&bus, 400000);
+    FUSB302_sim_bus_select(&bus);
+    FUSB302_sim_init(&sim, &bus, SIM_I2C_ADDRESS);
+    memset(&dev, 0, sizeof(dev));
+    dev.i2c_address = SIM_I2C_ADDRESS;
+    dev.context = &bus;
+    dev.i2c_read = FUSB302_sim_i2c_read;
+    dev.i2c_write = FUSB302_sim_i2c_write;
+    dev.delay_ms = FUSB302_sim_delay_ms;
+    dev.clock_us = FUSB302_sim_clock_us;
+    FUSB302_init(&dev);
+    FUSB302_sim_set_rp(&sim, 1, 3);
+    FUSB302_sim_set_vbus(&sim, 1);
+    for (uint32_t t = 0; t < 1000 && !FUSB302_is_attached(&dev); t++) {
+        if (FUSB302_sim_int_asserted(&sim) || FUSB302_timer_due(&dev)) {
+            op_alert(0);
+        }
+        FUSB302_sim_advance(&bus, 100);
+    }
+    if (!FUSB302_is_attached(&dev)) {
+        fprintf(stderr, "fusb302: attach failed\n");
+        return;
+    }
+    drain();
+
+    static const uint8_t tx_objs[] = {0, 1, 2, 7};
+    for (uint8_t i = 0; i < sizeof(tx_objs); i++) {
+        char name[40];
+        tx_count = tx_objs[i];
+        snprintf(name, sizeof(name), "fusb302.tx_sop.objs.%u", tx_count);
+        bench(name, 0, setup_tx_sop, op_tx_sop);
+    }
+    drain();
+    bench("fusb302.alert.idle", 0, 0, op_alert);
+    bench("fusb302.alert.rx_ctrl", "PS_RDY", setup_alert_ctrl, op_alert);
+    bench("fusb302.alert.rx_src_cap", "Src_Cap", setup_alert_src_cap, op_alert);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// PD_UFP_Log_c
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#if PD_UFP_LOG
+class Log_bench_c : public PD_UFP_Log_c
+{
+    public:
+        Log_bench_c(): PD_UFP_Log_c(PD_LOG_LEVEL_VERBOSE), message_id(0) {}
+        bool empty(void) { return status_log.count() == 0; }
+        void clear(void)
+        {
+            status_log.clear();
+            status_log_obj.clear();
+            status_log_overflow_events = 0;
+            status_log_overflow_objs = 0;
+            status_log_counter = 0;
+            status_log_time[0] = 0;
+        }
+        void event(uint8_t status) { status_log_event(status, (uint32_t *)pdo_mix); }
+        void add(uint8_t status)
+        {
+            uint16_t header = source_header(0x1, 7, false, ++message_id);
+            switch (status) {
+            case STATUS_LOG_MSG_RX:
+            case STATUS_LOG_SRC_CAP:
+                PD_protocol_handle_msg(&protocol, header, (uint32_t *)pdo_mix, 0);
+                status_log_event(status, (uint32_t *)pdo_mix);
+                break;
+            default:
+                status_power_ready(STATUS_POWER_TYP, PD_V(20), PD_A(2.25));
+                status_log_event(status, 0);
+                break;
+            }
+        }
+        uint8_t message_id;
+};
+
+static Log_bench_c * log_bench;
+static uint8_t log_status;
+static char log_line[80];
+
+static void setup_log(uint32_t n)
+{
+    if (log_bench->empty()) {
+        log_bench->add(log_status);
+    }
+}
+
+static void op_readline(uint32_t n)
+{
+    log_bench->status_log_readline(log_line, sizeof(log_line) - 1);
+}
+
+static void op_read_record(uint32_t n)
+{
+    uint8_t record[PD_UFP_LOG_RECORD_MAX];
+    log_bench->status_log_read_record(record, sizeof(record));
+}
+
+static void bench_log_event(const char * name, const char * label, uint8_t status, bench_fn_t op)
+{
+    log_bench->clear();
+    log_status = status;
+    bench(name, label, setup_log, op);
+}
+
+static void setup_log_clear(uint32_t n)
+{
+    log_bench->clear();
+}
+
+static void op_event(uint32_t n)
+{
+    log_bench->event(STATUS_LOG_MSG_RX);
+}
+
+static void bench_log(void)
+{
+    static Log_bench_c log;
+    FUSB302_sim_bus_select(&bus);
+    PD_UFP_c::set_hal(PD_UFP_HAL_host);
+    log_bench = &log;
+    /* Text lines, several per event */
+    bench_log_event("log.readline.power_ready", 0, STATUS_LOG_POWER_READY, op_readline);
+    bench_log_event("log.readline.src_cap", "7 PDOs", STATUS_LOG_SRC_CAP, op_readline);
+    bench_log_event("log.readline.msg_rx", "Src_Cap", STATUS_LOG_MSG_RX, op_readline);
+    /* Binary records, one per event */
+    bench_log_event("log.record.power_ready", 0, STATUS_LOG_POWER_READY, op_read_record);
+    bench_log_event("log.record.src_cap", "7 PDOs", STATUS_LOG_SRC_CAP, op_read_record);
+    bench_log_event("log.record.msg_rx", "Src_Cap", STATUS_LOG_MSG_RX, op_read_record);
+    /* Producer, received Source_Capabilities into an empty and into a full log */
+    log_bench->clear();
+    log_bench->add(STATUS_LOG_MSG_RX);
+    bench("log.event.msg_rx", "Src_Cap", setup_log_clear, op_event);
+    for (uint16_t dropped = log_bench->get_log_dropped_events(); dropped == log_bench->get_log_dropped_events(); ) {
+        log_bench->event(STATUS_LOG_MSG_RX);
+    }
+    bench("log.event.full", "Src_Cap", 0, op_event);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Output
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void print_text(void)
+{
+    printf("%-32s %-12s %10s %10s %8s %8s\n", "benchmark", "label", "ns_op", "ns_p99", "xfers_op", "bytes_op");
+    for (uint32_t i = 0; i < result_count; i++) {
+        const result_t * r = &results[i];
+        printf("%-32s %-12s %10.1f %10.1f %8.2f %8.2f\n", r->name, r->label, r->ns_median, r->ns_p99,
+            r->xfers_per_op, r->bytes_per_op);
+    }
+    printf("# benchmarks=%u iterations=%u batch=%u clock_overhead_ns=%u\n", (unsigned)result_count,
+        (unsigned)iterations, BATCH, (unsigned)clock_overhead);
+}
+
+static void print_json(void)
+{
+    printf("{\n  \"unit\": \"ns\",\n  \"iterations\": %u,\n  \"batch\": %u,\n  \"clock_overhead_ns\": %u,\n",
+        (unsigned)iterations, BATCH, (unsigned)clock_overhead);
+    printf("  \"config\": {\"PD_UFP_PPS\": %d, \"PD_UFP_EXT_MSG\": %d, \"PD_UFP_MSG_NAMES\": %d, \"PD_UFP_LOG\": %d},\n",
+        PD_UFP_PPS, PD_UFP_EXT_MSG, PD_UFP_MSG_NAMES, PD_UFP_LOG);
+    printf("  \"benchmarks\": [\n");
+    for (uint32_t i = 0; i < result_count; i++) {
+        const result_t * r = &results[i];
+        printf("    {\"name\": \"%s\", \"label\": \"%s\", \"samples\": %u, \"ns_per_op\": %.1f, \"ns_p99\": %.1f, "
+            "\"i2c_xfers_per_op\": %.2f, \"i2c_bytes_per_op\": %.2f}%s\n", r->name, r->label, (unsigned)r->samples,
+            r->ns_median, r->ns_p99, r->xfers_per_op, r->bytes_per_op, i + 1 < result_count ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--iterations=", 13) == 0) {
+            iterations = strtoul(argv[i] + 13, 0, 10);
+        } else if (strncmp(argv[i], "--filter=", 9) == 0) {
+            filter = argv[i] + 9;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else {
+            printf("unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (iterations == 0) {
+        iterations = 1;
+    }
+    sample = (uint32_t *)malloc(iterations * sizeof(uint32_t));
+
+    /* Cost of reading the clock */
+    clock_overhead = (uint64_t)-1;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t t0 = now_ns(), t1 = now_ns();
+        if (t1 - t0 < clock_overhead) {
+            clock_overhead = t1 - t0;
+        }
+    }
+
+    bench_protocol();
+    bench_fusb302();
+#if PD_UFP_LOG
+    bench_log();
+#endif
+
+    if (json) {
+        print_json();
+    } else {
+        print_text();
+    }
+    free(sample);
+    return 0;
+}
@@ -0,0 +1,128 @@
+
+/**
+ * PD_UFP_ports_bench.cpp
+ *
+ * Host benchmark: PD_UFP_Ports_c running 1...8 PD_UFP_c ports on one simulated I2C bus.
+ * All ports attach, then every source sends Source_Capabilities at the same time.
+ * Reports per port latency from Source_Capabilities to the Request leaving the chip,
+ * and the number of I2C transactions while waiting for all Requests.
+ * idle is the number of I2C transactions of all ports in 1s detached, before the attach.
+ * Build with -DPD_UFP_MAX_PORTS=8 for the whole build.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PD_UFP.h"
+#include "FUSB302_sim.h"
+#include "PD_UFP_HAL_host.h"
+
+#define SIM_I2C_ADDRESS     0x22
+#define MAX_PORTS           8
+
+static FUSB302_sim_bus_t bus;
+static FUSB302_sim_t sim[MAX_PORTS];
+static uint32_t request_time[MAX_PORTS];
+static uint8_t request_sent[MAX_PORTS];
+
+static uint8_t int_pin_read(uint8_t pin)
+{
+    return pin < MAX_PORTS && FUSB302_sim_int_asserted(&sim[pin]) ? 0 : 1;
+}
+
+static void on_tx(FUSB302_sim_t *s, uint16_t header, const uint32_t *obj)
+{
+    uint8_t port = (uint8_t)(s - sim);
+    if ((header & 0x1F) == 0x2 && ((header >> 12) & 0x7) && !request_sent[port]) {
+        request_sent[port] = 1;     /* Request */
+        request_time[port] = bus.time_us;
+    }
+}
+
+static void run_ports(PD_UFP_Ports_c & ports, uint32_t us)
+{
+    uint32_t t_end = bus.time_us + us;
+    while ((int32_t)(bus.time_us - t_end) < 0) {
+        ports.run();
+        FUSB302_sim_advance(&bus, 10);  /* application main loop */
+    }
+}
+
+static void bench(uint8_t n, uint32_t clock_hz)
+{
+    /* Source_Capabilities: 5V 3A, 9V 3A, 15V 3A, 20V 2.25A */
+    static const uint32_t src_cap[4] = {
+        (100UL << 10) | 300, (180UL << 10) | 300, (300UL << 10) | 300, (400UL << 10) | 225
+    };
+    static const uint16_t src_cap_header = 0x1 | (2 << 6) | (1 << 5) | (1 << 8) | (4 << 12);
+    PD_UFP_Ports_c ports;
+    PD_UFP_c port[MAX_PORTS];
+
+    FUSB302_sim_bus_init(&bus, clock_hz);
+    FUSB302_sim_bus_select(&bus);
+    for (uint8_t i = 0; i < n; i++) {
+        FUSB302_sim_init(&sim[i], &bus, SIM_I2C_ADDRESS + i);
+        sim[i].on_tx = on_tx;
+        request_sent[i] = 0;
+        port[i].set_i2c(&bus, SIM_I2C_ADDRESS + i);
+        port[i].init(i, PD_POWER_OPTION_MAX_20V);
+        ports.add(port[i]);
+    }
+
+    /* detached, no polling */
+    uint32_t idle = bus.stats.transactions;
+    run_ports(ports, 1000000);
+    idle = bus.stats.transactions - idle;
+
+    /* attach all ports */
+    for (uint8_t i = 0; i < n; i++) {
+        FUSB302_sim_set_rp(&sim[i], 1, 3);
+        FUSB302_sim_set_vbus(&sim[i], 1);
+    }
+    run_ports(ports, 100000);
+
+    FUSB302_sim_stats_t start = bus.stats;
+    uint32_t t0 = bus.time_us;
+    for (uint8_t i = 0; i < n; i++) {
+        FUSB302_sim_receive(&sim[i], src_cap_header, src_cap);
+    }
+    for (uint8_t done = 0; !done && bus.time_us - t0 < 200000; ) {
+        run_ports(ports, 100);
+        done = 1;
+        for (uint8_t i = 0; i < n; i++) {
+            done &= request_sent[i];
+        }
+    }
+
+    uint32_t sum = 0, max = 0, min = 0xFFFFFFFF;
+    uint8_t missing = 0;
+    for (uint8_t i = 0; i < n; i++) {
+        if (!request_sent[i]) {
+            missing++;
+            continue;
+        }
+        uint32_t t = request_time[i] - t0;
+        sum += t;
+        max = t > max ? t : max;
+        min = t < min ? t : min;
+    }
+    printf("%5u %8u %8u %8u %6u %8u %7u %5u\n", n, missing < n ? (unsigned)min : 0,
+        missing < n ? (unsigned)(sum / (n - missing)) : 0, (unsigned)max,
+        (unsigned)(bus.stats.transactions - start.transactions),
+        (unsigned)(bus.stats.bus_time_us - start.bus_time_us), missing, (unsigned)idle);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t clock_hz = argc > 1 ? strtoul(argv[1], 0, 10) : 100000;
+    PD_UFP_c::set_hal(PD_UFP_HAL_host);
+    PD_UFP_HAL_host_pin_read = int_pin_read;
+    printf("# I2C %u Hz, latency Source_Capabilities to Request in us\n", (unsigned)clock_hz);
+    printf("%5s %8s %8s %8s %6s %8s %7s %5s\n", "ports", "min", "mean", "max", "xfers", "bus_us", "missing", "idle");
+    for (uint8_t n = 1; n <= MAX_PORTS && n <= PD_UFP_MAX_PORTS; n++) {
+        bench(n, clock_hz);
+    }
+    return 0;
+}
@@ -0,0 +1,261 @@
+/**
+ * PD_UFP_power_bench.cpp
+ *
+ * Host benchmark: time to power of PD_UFP_c against randomized PD sources (PD_source_sim).
+ * Each profile attaches a source with random Rp level, PDOs, Source_Capabilities timing,
+ * lost messages, Get_Source_Cap support, response and transition times, Wait and Reject.
+ * The sink runs unmodified on FUSB302_sim through PD_UFP_HAL_host in virtual time.
+ * Reports per profile and in total:
+ *   time_to_power_ms   attach (Rp) to the sink reporting the voltage of the source's explicit contract
+ *   get_src_cap        Get_Source_Cap messages sent by the sink
+ *   hard_resets        hard resets sent by the sink
+ *   i2c_xfers/bytes    I2C traffic from attach to power, or to the end of the run
+ * fallback counts sinks that ended on vSafe5V without a contract, mismatch counts sinks that
+ * report a voltage the source does not supply.
+ * Options:
+ *   --profiles=n       number of random source profiles, default 500
+ *   --seed=n           random seed
+ *   --pps              sources offer PPS, the sink starts with init_PPS(9V, 2A)
+ *   --clock=hz         I2C clock, default 400000
+ *   --verbose          one line per profile
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "PD_UFP.h"
+#include "FUSB302_sim.h"
+#include "PD_UFP_HAL_host.h"
+#include "PD_source_sim.h"
+
+#define SIM_I2C_ADDRESS     0x22
+#define T_RUN_US            5000000     /* give up 5s after attach */
+#define T_STEP_US           100         /* application main loop */
+
+static FUSB302_sim_bus_t bus;
+static FUSB302_sim_t sim;
+static PD_source_sim_t source;
+static uint32_t rng_state = 1;
+
+static uint32_t rng(uint32_t n)
+{
+    /* xorshift32, result in 0 ... n - 1 */
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x % n;
+}
+
+static uint32_t rng_range(uint32_t lo, uint32_t hi)
+{
+    return lo + rng(hi - lo + 1);
+}
+
+static uint8_t int_pin_read(uint8_t pin)
+{
+    return FUSB302_sim_int_asserted(&sim) ? 0 : 1;
+}
+
+static void random_profile(PD_source_profile_t *p, bool pps)
+{
+    static const uint16_t fixed_v[] = {180, 240, 300, 400};    /* 9V, 12V, 15V, 20V in 50mV units */
+    memset(p, 0, sizeof(*p));
+    p->rp_level = rng_range(1, 3);
+    p->pdo[p->num_of_pdo++] = (100UL << 10) | rng_range(150, 300);
+    for (uint8_t i = 0; i < sizeof(fixed_v) / sizeof(fixed_v[0]); i++) {
+        if (rng(3)) {
+            p->pdo[p->num_of_pdo++] = ((uint32_t)fixed_v[i] << 10) | rng_range(150, 300);
+        }
+    }
+    if (pps) {
+        /* 3.3V ... 11V or 21V */
+        p->pdo[p->num_of_pdo++] = (3UL << 30) | ((uint32_t)(rng(2) ? 110 : 210) << 17) | (33UL << 8) | rng_range(40, 100);
+    }
+    p->t_vbus_us = rng_range(5, 100) * 1000;
+    p->t_first_src_cap_us = rng_range(20, 250) * 1000;
+    p->t_src_cap_us = rng_range(100, 200) * 1000;
+    p->src_cap_count = rng(10) == 0 ? 0 : rng(5) == 0 ? 1 : 50;
+    p->src_cap_lost = rng(4) == 0 ? rng_range(1, 2) : 0;
+    p->ignore_get_src_cap = rng(10) == 0;
+    p->t_response_us = rng_range(1000, 15000);
+    p->t_transition_us = rng_range(30, 500) * 1000;
+    p->t_pps_transition_us = rng_range(5, 25) * 1000;
+    p->wait_count = rng(10) == 0;
+    p->reject_count = rng(10) == 0;
+    p->pps_status = 1;
+    p->t_hard_reset_us = rng_range(25, 35) * 1000;
+    p->t_src_recover_us = rng_range(660, 1000) * 1000 + 275000;
+}
+
+typedef struct {
+    uint32_t time_to_power_us;
+    uint32_t get_src_cap;
+    uint32_t hard_resets;
+    uint32_t xfers;
+    uint32_t bytes;
+    uint8_t power;          /* sink reports the source's contract voltage */
+    uint8_t fallback;
+    uint8_t mismatch;
+    uint16_t voltage_mv;
+} result_t;
+
+static uint16_t sink_voltage_mv(PD_UFP_c & pd)
+{
+    if (pd.is_PPS_ready()) {
+        return pd.get_voltage() * 20;
+    }
+    return pd.is_power_ready() ? pd.get_voltage() * 50 : 0;
+}
+
+static void run_profile(const PD_source_profile_t *profile, bool pps, uint32_t clock_hz, result_t *r)
+{
+    FUSB302_sim_bus_init(&bus, clock_hz);
+    FUSB302_sim_bus_select(&bus);
+    FUSB302_sim_init(&sim, &bus, SIM_I2C_ADDRESS);
+    PD_source_sim_init(&source, &sim, profile);
+
+    PD_UFP_c pd;
+    pd.set_i2c(&bus, SIM_I2C_ADDRESS);
+#if PD_UFP_PPS
+    if (pps) {
+        pd.init_PPS(0, PPS_V(9.0), PPS_A(2.0), PD_POWER_OPTION_MAX_20V);
+    } else
+#endif
+    {
+        pd.init(0, PD_POWER_OPTION_MAX_20V);
+    }
+
+    memset(r, 0, sizeof(*r));
+    FUSB302_sim_stats_t start = bus.stats;
+    uint32_t t0 = bus.time_us;
+    PD_source_sim_attach(&source, rng_range(1, 2));
+    while (bus.time_us - t0 < T_RUN_US) {
+        pd.run();
+        FUSB302_sim_advance(&bus, T_STEP_US);
+        PD_source_sim_update(&source);
+        if (source.contract && !source.ps_rdy_pending && sink_voltage_mv(pd) == source.output_mv) {
+            r->power = 1;
+            r->time_to_power_us = bus.time_us - t0;
+            break;
+        }
+    }
+    r->voltage_mv = sink_voltage_mv(pd);
+    r->fallback = !r->power && r->voltage_mv == 5000 && !source.contract;
+    r->mismatch = r->voltage_mv && r->voltage_mv != source.output_mv;
+    r->get_src_cap = source.stats.get_src_cap;
+    r->hard_resets = source.stats.hard_resets;
+    r->xfers = bus.stats.transactions - start.transactions;
+    r->bytes = bus.stats.bytes - start.bytes;
+}
+
+static int compare_u32(const void * a, const void * b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_metric(const char * name, uint32_t * v, uint32_t count, uint32_t scale)
+{
+    qsort(v, count, sizeof(uint32_t), compare_u32);
+    printf("%-18s", name);
+    if (count == 0) {
+        printf(" %8s %8s %8s %8s %8s\n", "-", "-", "-", "-", "-");
+        return;
+    }
+    const double q[5] = {0, 0.5, 0.9, 0.99, 1};
+    for (int i = 0; i < 5; i++) {
+        printf(" %8u", (unsigned)(v[(uint32_t)((count - 1) * q[i])] / scale));
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t profiles = 500, clock_hz = 400000;
+    bool pps = false, verbose = false;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--profiles=", 11) == 0) {
+            profiles = strtoul(argv[i] + 11, 0, 10);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            /* xorshift32 stays at 0 */
+            uint32_t v = strtoul(argv[i] + 7, 0, 10);
+            rng_state = v ? v : 1;
+        } else if (strncmp(argv[i], "--clock=", 8) == 0) {
+            clock_hz = strtoul(argv[i] + 8, 0, 10);
+        } else if (strcmp(argv[i], "--pps") == 0) {
+#if PD_UFP_PPS
+            pps = true;
+#else
+            printf("--pps requires PD_UFP_PPS\n");
+            return 1;
+#endif
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        } else {
+            printf("unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (profiles == 0) {
+        return 0;
+    }
+    PD_UFP_c::set_hal(PD_UFP_HAL_host);
+    PD_UFP_HAL_host_pin_read = int_pin_read;
+
+    uint32_t *ttp = (uint32_t *)malloc(profiles * sizeof(uint32_t));
+    uint32_t *gsc = (uint32_t *)malloc(profiles * sizeof(uint32_t));
+    uint32_t *hr = (uint32_t *)malloc(profiles * sizeof(uint32_t));
+    uint32_t *xfers = (uint32_t *)malloc(profiles * sizeof(uint32_t));
+    uint32_t *bytes = (uint32_t *)malloc(profiles * sizeof(uint32_t));
+    uint32_t powered = 0, fallback = 0, mismatch = 0, get_src_cap = 0, hard_resets = 0;
+
+    if (verbose) {
+        printf("%7s %2s %4s %5s %5s %4s %4s %4s %9s %5s %5s %7s %5s\n", "profile", "rp", "pdos", "caps", "lost",
+            "wait", "rej", "ign", "ttp_ms", "gsc", "hrst", "xfers", "mv");
+    }
+    for (uint32_t n = 0; n < profiles; n++) {
+        PD_source_profile_t profile;
+        result_t r;
+        random_profile(&profile, pps);
+        run_profile(&profile, pps, clock_hz, &r);
+        if (r.power) {
+            ttp[powered++] = r.time_to_power_us;
+        }
+        gsc[n] = r.get_src_cap;
+        hr[n] = r.hard_resets;
+        xfers[n] = r.xfers;
+        bytes[n] = r.bytes;
+        get_src_cap += r.get_src_cap;
+        hard_resets += r.hard_resets;
+        fallback += r.fallback;
+        mismatch += r.mismatch;
+        if (verbose) {
+            printf("%7u %2u %4u %5u %5u %4u %4u %4u %9.1f %5u %5u %7u %5u%s\n", (unsigned)n, profile.rp_level,
+                profile.num_of_pdo, profile.src_cap_count, profile.src_cap_lost, profile.wait_count,
+                profile.reject_count, profile.ignore_get_src_cap, r.power ? r.time_to_power_us / 1000.0 : -1.0,
+                (unsigned)r.get_src_cap, (unsigned)r.hard_resets, (unsigned)r.xfers, r.voltage_mv,
+                r.mismatch ? " mismatch" : r.fallback ? " fallback" : "");
+        }
+    }
+
+    printf("%-18s %8s %8s %8s %8s %8s\n", "metric", "min", "p50", "p90", "p99", "max");
+    print_metric("time_to_power_ms", ttp, powered, 1000);
+    print_metric("get_src_cap", gsc, profiles, 1);
+    print_metric("hard_resets", hr, profiles, 1);
+    print_metric("i2c_xfers", xfers, profiles, 1);
+    print_metric("i2c_bytes", bytes, profiles, 1);
+    printf("# profiles=%u powered=%u fallback=%u no_power=%u mismatch=%u get_src_cap=%u hard_resets=%u clock_hz=%u%s\n",
+        (unsigned)profiles, (unsigned)powered, (unsigned)fallback, (unsigned)(profiles - powered - fallback),
+        (unsigned)mismatch, (unsigned)get_src_cap, (unsigned)hard_resets, (unsigned)clock_hz, pps ? " pps" : "");
+
+    free(ttp);
+    free(gsc);
+    free(hr);
+    free(xfers);
+    free(bytes);
+    return mismatch ? 1 : 0;
+}
@@ -0,0 +1,258 @@
+/**
+ * PD_policy_bench.cpp
+ *
+ * Host benchmark: cost of the Fixed / Variable / Battery PDO selection (PD_protocol_set_power_policy)
+ * over randomized Source_Capabilities and randomized policies.
+ * Every selection is checked against a reference written in V / A / W floating point.
+ * Reports cycles per selection by number of PDOs, TSC ticks on x86, ns elsewhere.
+ * Options:
+ *   --sets=n           number of capability sets, default 200000
+ *   --seed=n           random seed
+ *   --budget=cycles    exit with 1 if the p99.9 of any PDO count is above the budget
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "PD_UFP_Protocol.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLE_UNIT      "tsc"
+static inline uint64_t cycles(void) { return __rdtsc(); }
+#else
+#include <time.h>
+#define CYCLE_UNIT      "ns"
+static inline uint64_t cycles(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(uint32_t n)
+{
+    /* xorshift32, result in 0 ... n - 1 */
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x % n;
+}
+
+static uint32_t rng_range(uint32_t lo, uint32_t hi)
+{
+    return lo + rng(hi - lo + 1);
+}
+
+static uint8_t random_caps(uint32_t * obj)
+{
+    uint8_t n = rng_range(1, PD_PROTOCOL_MAX_NUM_OF_PDO);
+    obj[0] = (100UL << 10) | rng_range(50, 300);    /* vSafe5V first */
+    for (uint8_t i = 1; i < n; i++) {
+        uint32_t min_v = rng_range(60, 300), max_v = rng_range(min_v, 420);
+        switch (rng(4)) {
+        case PD_PDO_TYPE_FIXED_SUPPLY:
+            obj[i] = ((uint32_t)PD_PDO_TYPE_FIXED_SUPPLY << 30) | (max_v << 10) | rng_range(0, 500);
+            break;
+        case PD_PDO_TYPE_BATTERY:
+            obj[i] = ((uint32_t)PD_PDO_TYPE_BATTERY << 30) | (max_v << 20) | (min_v << 10) | rng_range(0, 400);
+            break;
+        case PD_PDO_TYPE_VARIABLE_SUPPLY:
+            obj[i] = ((uint32_t)PD_PDO_TYPE_VARIABLE_SUPPLY << 30) | (max_v << 20) | (min_v << 10) | rng_range(0, 500);
+            break;
+        default:
+            obj[i] = ((uint32_t)PD_PDO_TYPE_AUGMENTED_PDO << 30) | ((max_v / 2) << 17) | ((min_v / 2) << 8) | rng_range(0, 100);
+            break;
+        }
+    }
+    return n;
+}
+
+static void random_policy(PD_power_policy_t * policy)
+{
+    policy->min_v = rng(4) ? rng_range(0, 200) : 0;
+    policy->max_v = rng_range(policy->min_v, 0x3FF);
+    policy->min_i = rng(2) ? rng_range(0, 300) : 0;
+    policy->min_p = rng(2) ? rng_range(0, 200) : 0;
+    policy->types = rng_range(1, PD_POWER_TYPE_ALL);
+    for (uint8_t k = 0; k < PD_POWER_POLICY_NUM_OF_PREFER; k++) {
+        policy->prefer[k] = rng(5);
+    }
+}
+
+/* Reference selection in V / A / W */
+typedef struct {
+    double min_v, max_v, i, p;
+} ref_point_t;
+
+static bool ref_point(uint32_t obj, uint8_t types, ref_point_t * r)
+{
+    uint8_t type = obj >> 30;
+    double a = ((obj >> 20) & 0x3FF) * 0.05, b = ((obj >> 10) & 0x3FF) * 0.05, c = (obj & 0x3FF);
+    if (type == PD_PDO_TYPE_AUGMENTED_PDO || !(types & PD_POWER_TYPE(type))) {
+        return false;
+    }
+    if (type == PD_PDO_TYPE_FIXED_SUPPLY) {
+        r->min_v = r->max_v = b;
+        r->i = c * 0.01;
+        r->p = r->min_v * r->i;
+    } else if (type == PD_PDO_TYPE_VARIABLE_SUPPLY) {
+        r->min_v = b;
+        r->max_v = a;
+        r->i = c * 0.01;
+        r->p = r->min_v * r->i;
+    } else {
+        r->min_v = b;
+        r->max_v = a;
+        r->p = c * 0.25;
+        r->i = a > 0 ? floor(r->p / r->max_v * 100 + 1e-9) * 0.01 : 0;  /* 10mA resolution */
+    }
+    return true;
+}
+
+static double ref_key(const ref_point_t * r, uint8_t prefer)
+{
+    switch (prefer) {
+    case PD_POWER_PREFER_HIGH_VOLTAGE:  return r->min_v;
+    case PD_POWER_PREFER_LOW_VOLTAGE:   return -r->max_v;
+    case PD_POWER_PREFER_CURRENT:       return r->i;
+    case PD_POWER_PREFER_POWER:         return r->p;
+    default:                            return 0;
+    }
+}
+
+static uint8_t ref_select(const uint32_t * obj, uint8_t n, const PD_power_policy_t * policy)
+{
+    const double eps = 1e-9;
+    ref_point_t r, best = {0, 0, 0, 0};
+    uint8_t selected = 0;
+    bool found = false;
+    for (uint8_t i = 0; i < n; i++) {
+        if (!ref_point(obj[i], policy->types, &r)) {
+            continue;
+        }
+        if (r.min_v < policy->min_v * 0.05 - eps || r.max_v > policy->max_v * 0.05 + eps ||
+            r.i < policy->min_i * 0.01 - eps || r.p < policy->min_p * 0.25 - eps) {
+            continue;
+        }
+        bool better = !found;
+        for (uint8_t k = 0; k < PD_POWER_POLICY_NUM_OF_PREFER && !better; k++) {
+            double a = ref_key(&r, policy->prefer[k]), b = ref_key(&best, policy->prefer[k]);
+            if (fabs(a - b) > eps) {
+                better = a > b;
+                break;
+            }
+        }
+        if (better) {
+            best = r;
+            selected = i;
+            found = true;
+        }
+    }
+    return selected;
+}
+
+static int compare_u32(const void * a, const void * b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const uint32_t * sorted, uint32_t count, double q)
+{
+    return count ? sorted[(uint32_t)((count - 1) * q)] : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t sets = 200000, budget = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--sets=", 7) == 0) {
+            sets = strtoul(argv[i] + 7, 0, 10);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            /* xorshift32 stays at 0 */
+            uint32_t v = strtoul(argv[i] + 7, 0, 10);
+            rng_state = v ? v : 1;
+        } else if (strncmp(argv[i], "--budget=", 9) == 0) {
+            budget = strtoul(argv[i] + 9, 0, 10);
+        } else {
+            printf("unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    /* Cost of reading the cycle counter */
+    uint64_t overhead = (uint64_t)-1;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t t0 = cycles(), t1 = cycles();
+        if (t1 - t0 < overhead) {
+            overhead = t1 - t0;
+        }
+    }
+
+    uint32_t * sample[PD_PROTOCOL_MAX_NUM_OF_PDO + 1];
+    uint32_t count[PD_PROTOCOL_MAX_NUM_OF_PDO + 1] = {0};
+    for (int n = 0; n <= PD_PROTOCOL_MAX_NUM_OF_PDO; n++) {
+        sample[n] = (uint32_t *)malloc(sizeof(uint32_t) * (sets ? sets : 1));
+    }
+
+    static PD_protocol_t protocol;
+    uint32_t mismatches = 0, fallbacks = 0;
+    PD_protocol_init(&protocol);
+    for (uint32_t s = 0; s < sets; s++) {
+        uint32_t obj[PD_PROTOCOL_MAX_NUM_OF_PDO];
+        PD_power_policy_t policy;
+        uint8_t n = random_caps(obj);
+        random_policy(&policy);
+        /* Source_Capabilities, alternate MessageID so no message is dropped as a retransmission */
+        uint16_t header = 0x1 | (2 << 6) | ((uint16_t)(s & 0x7) << 9) | ((uint16_t)n << 12);
+        PD_protocol_handle_msg(&protocol, header, obj, 0);
+
+        uint64_t t0 = cycles();
+        PD_protocol_set_power_policy(&protocol, &policy);
+        uint64_t t1 = cycles();
+        uint64_t t = t1 - t0 > overhead ? t1 - t0 - overhead : 0;
+        sample[n][count[n]++] = (uint32_t)t;
+        sample[0][count[0]++] = (uint32_t)t;
+
+        uint8_t selected = PD_protocol_get_selected_power(&protocol);
+        if (selected != ref_select(obj, n, &policy)) {
+            if (mismatches++ < 5) {
+                printf("mismatch set %u: selected %u, reference %u\n", (unsigned)s, selected, ref_select(obj, n, &policy));
+            }
+        }
+        fallbacks += selected == 0;
+    }
+
+    bool over_budget = false;
+    printf("%-6s %8s %8s %8s %8s %8s\n", "pdos", "sets", "median", "p99", "p99.9", "max");
+    for (int n = 1; n <= PD_PROTOCOL_MAX_NUM_OF_PDO + 1; n++) {
+        int m = n % (PD_PROTOCOL_MAX_NUM_OF_PDO + 1);  /* all sets last */
+        qsort(sample[m], count[m], sizeof(uint32_t), compare_u32);
+        uint32_t p999 = percentile(sample[m], count[m], 0.999);
+        char name[8];
+        snprintf(name, sizeof(name), m ? "%d" : "all", m);
+        printf("%-6s %8u %8u %8u %8u %8u\n", name, (unsigned)count[m],
+            (unsigned)percentile(sample[m], count[m], 0.5), (unsigned)percentile(sample[m], count[m], 0.99),
+            (unsigned)p999, (unsigned)(count[m] ? sample[m][count[m] - 1] : 0));
+        if (budget && p999 > budget) {
+            over_budget = true;
+        }
+    }
+    printf("# unit=%s overhead=%u sets=%u mismatches=%u vsafe5v_selected=%u budget=%u%s\n",
+        CYCLE_UNIT, (unsigned)overhead, (unsigned)sets, (unsigned)mismatches, (unsigned)fallbacks,
+        (unsigned)budget, over_budget ? " over_budget" : "");
+
+    for (int n = 0; n <= PD_PROTOCOL_MAX_NUM_OF_PDO; n++) {
+        free(sample[n]);
+    }
+    return mismatches || over_budget ? 1 : 0;
+}
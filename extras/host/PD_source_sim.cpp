@@ -0,0 +1,298 @@
+/**
+ * PD_source_sim.cpp
+ *
+ * USB PD source partner for FUSB302_sim, host (Linux) builds
+ * See PD_source_sim.h
+ *
+ * Reference: USB_PD_R3_0 V2.0 20190829
+ *            - 6.6 Timers, 6.7 Counters
+ *            - 8.3.3.2 Policy Engine Source Port State Diagram
+ *
+ */
+
+#include <string.h>
+#include "PD_source_sim.h"
+
+#define CTRL_ACCEPT             0x3
+#define CTRL_REJECT             0x4
+#define CTRL_PS_RDY             0x6
+#define CTRL_GET_SRC_CAP        0x7
+#define CTRL_WAIT               0xC
+#define CTRL_GET_PPS_STATUS     0x14
+#define DATA_SRC_CAP            0x1
+#define DATA_REQUEST            0x2
+#define EXT_PPS_STATUS          0xC
+
+#define REPLY_SRC_CAP           0xF0
+#define REPLY_PPS_STATUS        0xF1
+
+#define N_CAPS_COUNT            50      /* nCapsCount */
+#define N_RETRY_COUNT           2       /* nRetryCount */
+
+static uint16_t source_header(PD_source_sim_t *src, uint8_t type, uint8_t num_of_obj, bool extended)
+{
+    return type | (2 << 6) |                    /* Specification Revision 3.0 */
+           (1 << 5) | (1 << 8) |                /* DFP, Source */
+           ((uint16_t)src->message_id << 9) | ((uint16_t)num_of_obj << 12) | (extended ? (1 << 15) : 0);
+}
+
+static bool source_send(PD_source_sim_t *src, uint8_t type, uint8_t num_of_obj, const uint32_t *obj, bool extended)
+{
+    /* The sink PHY answers GoodCRC when it received the message, retried nRetryCount times */
+    uint16_t header = source_header(src, type, num_of_obj, extended);
+    for (uint8_t i = 0; i <= N_RETRY_COUNT; i++) {
+        if (FUSB302_sim_receive(src->sim, header, obj) == FUSB302_SIM_RX_GOOD_CRC) {
+            src->message_id = (src->message_id + 1) & 0x7;
+            return true;
+        }
+    }
+    src->stats.tx_failed++;
+    return false;
+}
+
+static void source_reset(PD_source_sim_t *src)
+{
+    src->message_id = 0;
+    src->src_cap_pending = 0;
+    src->reply_pending = 0;
+    src->ps_rdy_pending = 0;
+    src->contract = 0;
+    src->contract_pos = 0;
+    src->next_pos = 0;
+    src->output_ma = 0;
+    src->src_cap_left = src->profile.src_cap_count;
+}
+
+static void source_vbus(PD_source_sim_t *src, uint8_t on)
+{
+    src->output_mv = on ? 5000 : 0;
+    FUSB302_sim_set_vbus(src->sim, on);
+    if (on && src->src_cap_left) {
+        src->src_cap_pending = 1;
+        src->src_cap_us = src->sim->bus->time_us + src->profile.t_first_src_cap_us;
+    }
+}
+
+static void source_send_src_cap(PD_source_sim_t *src, bool unsolicited)
+{
+    bool lost = src->stats.src_cap_lost < src->profile.src_cap_lost;
+    if (lost) {
+        src->stats.src_cap_lost++;
+    } else if (source_send(src, DATA_SRC_CAP, src->profile.num_of_pdo, src->profile.pdo, false)) {
+        src->stats.src_cap_sent++;
+        src->src_cap_left = 0;
+        return;
+    }
+    /* No GoodCRC, repeat after tTypeCSendSourceCap */
+    if (unsolicited && src->src_cap_left && --src->src_cap_left) {
+        src->src_cap_pending = 1;
+        src->src_cap_us = src->sim->bus->time_us + src->profile.t_src_cap_us;
+    }
+}
+
+static void source_send_PPS_status(PD_source_sim_t *src)
+{
+    /* Reference: 6.5.10 PPS_Status Message, 2-byte Extended Message Header, 4-byte PPSSDB */
+    uint16_t v = 0xFFFF;
+    uint8_t i = 0xFF;
+    uint32_t obj[2];
+    if (src->contract && src->output_mv) {
+        v = (uint16_t)((src->output_mv + src->profile.pps_offset_mv) / 20);
+        i = (uint8_t)(src->output_ma / 50);
+    }
+    obj[0] = 4 | (1UL << 15) | ((uint32_t)(v & 0xFF) << 16) | ((uint32_t)(v >> 8) << 24);
+    obj[1] = i | (1UL << 9);    /* PTF normal */
+    if (source_send(src, EXT_PPS_STATUS, 2, obj, true)) {
+        src->stats.pps_status++;
+    }
+}
+
+static uint8_t source_evaluate_request(PD_source_sim_t *src, uint32_t rdo)
+{
+    /* Reference: 6.4.2 Request Message, returns the reply */
+    uint8_t pos = (rdo >> 28) & 0x7;
+    if (pos == 0 || pos > src->profile.num_of_pdo) {
+        return CTRL_REJECT;
+    }
+    uint32_t pdo = src->profile.pdo[pos - 1];
+    switch (pdo >> 30) {
+    case 0: /* Fixed */
+    case 2: /* Variable */
+        if (((rdo >> 10) & 0x3FF) > (pdo & 0x3FF)) {
+            return CTRL_REJECT;
+        }
+        src->next_mv = (uint16_t)(((pdo >> 10) & 0x3FF) * 50);
+        src->next_ma = (uint16_t)(((rdo >> 10) & 0x3FF) * 10);
+        break;
+    case 1: /* Battery, operating power in 250mW units */
+        if (((rdo >> 10) & 0x3FF) > (pdo & 0x3FF)) {
+            return CTRL_REJECT;
+        }
+        src->next_mv = (uint16_t)(((pdo >> 10) & 0x3FF) * 50);
+        src->next_ma = 0;
+        break;
+    default: { /* PPS, 20mV and 50mA units */
+        uint16_t mv = (uint16_t)(((rdo >> 9) & 0x7FF) * 20);
+        uint16_t ma = (uint16_t)((rdo & 0x7F) * 50);
+        if (mv < ((pdo >> 8) & 0xFF) * 100 || mv > ((pdo >> 17) & 0xFF) * 100 || ma > (pdo & 0x7F) * 50) {
+            return CTRL_REJECT;
+        }
+        src->next_mv = mv;
+        src->next_ma = ma;
+        break;
+    }
+    }
+    if (src->wait_left) {
+        src->wait_left--;
+        return CTRL_WAIT;
+    }
+    if (src->reject_left) {
+        src->reject_left--;
+        return CTRL_REJECT;
+    }
+    src->next_pos = pos;
+    return CTRL_ACCEPT;
+}
+
+static void source_reply(PD_source_sim_t *src, uint8_t type)
+{
+    src->reply_pending = 1;
+    src->reply_type = type;
+    src->reply_us = src->sim->bus->time_us + src->profile.t_response_us;
+}
+
+static void on_sink_tx(FUSB302_sim_t *sim, uint16_t header, const uint32_t *obj)
+{
+    PD_source_sim_t *src = (PD_source_sim_t *)sim->partner;
+    uint8_t type = header & 0x1F;
+    uint8_t num_of_obj = (header >> 12) & 0x7;
+    if (src == 0 || src->cc == 0 || (header >> 15)) {
+        return;
+    }
+    if (num_of_obj == 0 && type == CTRL_GET_SRC_CAP) {
+        src->stats.get_src_cap++;
+        if (!src->profile.ignore_get_src_cap) {
+            source_reply(src, REPLY_SRC_CAP);
+        }
+    } else if (num_of_obj == 0 && type == CTRL_GET_PPS_STATUS) {
+        if (src->profile.pps_status) {
+            source_reply(src, REPLY_PPS_STATUS);
+        }
+    } else if (num_of_obj && type == DATA_REQUEST) {
+        src->stats.requests++;
+        source_reply(src, source_evaluate_request(src, obj[0]));
+    }
+}
+
+static void on_sink_hard_reset(FUSB302_sim_t *sim)
+{
+    PD_source_sim_t *src = (PD_source_sim_t *)sim->partner;
+    if (src == 0 || src->cc == 0) {
+        return;
+    }
+    /* Reference: 7.1.5 Response to Hard Resets, VBUS to vSafe0V and back to vSafe5V */
+    src->stats.hard_resets++;
+    source_reset(src);
+    src->vbus_pending = 1;
+    src->vbus_next = 0;
+    src->vbus_us = sim->bus->time_us + src->profile.t_hard_reset_us;
+}
+
+void PD_source_sim_init(PD_source_sim_t *src, FUSB302_sim_t *sim, const PD_source_profile_t *profile)
+{
+    memset(src, 0, sizeof(PD_source_sim_t));
+    src->sim = sim;
+    src->profile = *profile;
+    if (src->profile.num_of_pdo > PD_SOURCE_SIM_MAX_PDO) {
+        src->profile.num_of_pdo = PD_SOURCE_SIM_MAX_PDO;
+    }
+    sim->partner = src;
+    sim->on_tx = on_sink_tx;
+    sim->on_hard_reset = on_sink_hard_reset;
+}
+
+void PD_source_sim_attach(PD_source_sim_t *src, uint8_t cc)
+{
+    source_reset(src);
+    src->cc = cc;
+    src->wait_left = src->profile.wait_count;
+    src->reject_left = src->profile.reject_count;
+    src->contract_us = 0;
+    FUSB302_sim_set_rp(src->sim, cc, src->profile.rp_level);
+    src->vbus_pending = 1;
+    src->vbus_next = 1;
+    src->vbus_us = src->sim->bus->time_us + src->profile.t_vbus_us;
+}
+
+void PD_source_sim_detach(PD_source_sim_t *src)
+{
+    source_reset(src);
+    src->cc = 0;
+    src->vbus_pending = 0;
+    src->output_mv = 0;
+    FUSB302_sim_set_vbus(src->sim, 0);
+    FUSB302_sim_set_rp(src->sim, 0, 0);
+}
+
+void PD_source_sim_update(PD_source_sim_t *src)
+{
+    uint32_t t = src->sim->bus->time_us;
+    if (src->cc == 0) {
+        return;
+    }
+    if (src->vbus_pending && (int32_t)(t - src->vbus_us) >= 0) {
+        src->vbus_pending = 0;
+        source_vbus(src, src->vbus_next);
+        if (!src->vbus_next) {
+            /* Hard reset, VBUS back on after tSrcRecover */
+            src->vbus_pending = 1;
+            src->vbus_next = 1;
+            src->vbus_us = t + src->profile.t_src_recover_us;
+        }
+    }
+    if (src->src_cap_pending && (int32_t)(t - src->src_cap_us) >= 0) {
+        src->src_cap_pending = 0;
+        source_send_src_cap(src, true);
+    }
+    if (src->reply_pending && (int32_t)(t - src->reply_us) >= 0) {
+        src->reply_pending = 0;
+        switch (src->reply_type) {
+        case REPLY_SRC_CAP:
+            source_send_src_cap(src, false);
+            break;
+        case REPLY_PPS_STATUS:
+            source_send_PPS_status(src);
+            break;
+        case CTRL_ACCEPT:
+            if (source_send(src, CTRL_ACCEPT, 0, 0, false)) {
+                uint32_t pdo = src->profile.pdo[src->next_pos - 1];
+                src->stats.accepts++;
+                src->ps_rdy_pending = 1;
+                src->ps_rdy_us = t + ((pdo >> 30) == 3 ? src->profile.t_pps_transition_us : src->profile.t_transition_us);
+            }
+            break;
+        default:
+            if (source_send(src, src->reply_type, 0, 0, false)) {
+                if (src->reply_type == CTRL_REJECT) {
+                    src->stats.rejects++;
+                } else {
+                    src->stats.waits++;
+                }
+            }
+            break;
+        }
+    }
+    if (src->ps_rdy_pending && (int32_t)(t - src->ps_rdy_us) >= 0) {
+        src->ps_rdy_pending = 0;
+        src->output_mv = src->next_mv;
+        src->output_ma = src->next_ma;
+        src->contract_pos = src->next_pos;
+        if (source_send(src, CTRL_PS_RDY, 0, 0, false)) {
+            src->stats.ps_rdy++;
+            if (!src->contract) {
+                src->contract_us = t;
+            }
+            src->contract = 1;
+        }
+    }
+}
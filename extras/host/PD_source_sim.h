@@ -0,0 +1,95 @@
+/**
+ * PD_source_sim.h
+ *
+ * USB PD source partner for FUSB302_sim, host (Linux) builds
+ * Drives the partner side of one FUSB302_sim_t in virtual time: Rp and VBUS on attach,
+ * Source_Capabilities with tFirstSourceCap / tTypeCSendSourceCap timing and retries,
+ * Get_Source_Cap, Request evaluation with Accept / Reject / Wait and PS_RDY after the
+ * power supply transition, PPS requests and PPS_Status, and hard reset recovery.
+ * Call PD_source_sim_update() after every FUSB302_sim_advance().
+ *
+ */
+
+#ifndef PD_SOURCE_SIM_H
+#define PD_SOURCE_SIM_H
+
+#include <stdint.h>
+
+#include "FUSB302_sim.h"
+
+#define PD_SOURCE_SIM_MAX_PDO       7
+
+typedef struct {
+    uint8_t rp_level;               /* BC_LVL of Rp: 1 = default USB, 2 = 1.5A, 3 = 3.0A */
+    uint8_t num_of_pdo;
+    uint32_t pdo[PD_SOURCE_SIM_MAX_PDO];
+    uint32_t t_vbus_us;             /* Rp to VBUS on, tVBUSON */
+    uint32_t t_first_src_cap_us;    /* VBUS on to first Source_Capabilities, tFirstSourceCap */
+    uint32_t t_src_cap_us;          /* Source_Capabilities repeat without GoodCRC, tTypeCSendSourceCap */
+    uint8_t src_cap_count;          /* Source_Capabilities sent unsolicited, 0 = only on Get_Source_Cap */
+    uint8_t src_cap_lost;           /* First n Source_Capabilities are lost on the wire */
+    uint8_t ignore_get_src_cap;     /* Get_Source_Cap is not answered */
+    uint32_t t_response_us;         /* Message to response, tReceiverResponse */
+    uint32_t t_transition_us;       /* Accept to PS_RDY of a Fixed / Variable / Battery contract */
+    uint32_t t_pps_transition_us;   /* Accept to PS_RDY of a PPS contract */
+    uint8_t wait_count;             /* First n valid Requests are answered with Wait */
+    uint8_t reject_count;           /* Next n valid Requests are answered with Reject */
+    uint8_t pps_status;             /* Get_PPS_Status is answered */
+    int16_t pps_offset_mv;          /* PPS output offset, reported in PPS_Status */
+    uint32_t t_hard_reset_us;       /* Hard reset to VBUS off, tPSHardReset */
+    uint32_t t_src_recover_us;      /* VBUS off to on after hard reset, tSrcRecover + tSrcTurnOn */
+} PD_source_profile_t;
+
+typedef struct {
+    uint32_t src_cap_sent;          /* Source_Capabilities with GoodCRC */
+    uint32_t src_cap_lost;
+    uint32_t get_src_cap;           /* Get_Source_Cap received */
+    uint32_t requests;
+    uint32_t accepts;
+    uint32_t rejects;
+    uint32_t waits;
+    uint32_t ps_rdy;
+    uint32_t pps_status;
+    uint32_t hard_resets;           /* Hard resets received */
+    uint32_t tx_failed;             /* Messages without GoodCRC */
+} PD_source_stats_t;
+
+typedef struct {
+    FUSB302_sim_t *sim;
+    PD_source_profile_t profile;
+    PD_source_stats_t stats;
+    uint8_t cc;                     /* CC pin with Rp, 0 = detached */
+    uint8_t message_id;
+    uint8_t src_cap_left;           /* unsolicited Source_Capabilities left */
+    uint8_t wait_left;
+    uint8_t reject_left;
+
+    /* Pending actions, due at *_us if the flag is set */
+    uint8_t vbus_pending;
+    uint8_t vbus_next;
+    uint32_t vbus_us;
+    uint8_t src_cap_pending;
+    uint32_t src_cap_us;
+    uint8_t reply_pending;
+    uint8_t reply_type;             /* Control message type, or Source_Capabilities / PPS_Status */
+    uint32_t reply_us;
+    uint8_t ps_rdy_pending;
+    uint32_t ps_rdy_us;
+
+    /* Contract */
+    uint8_t contract;               /* Explicit contract, PS_RDY sent */
+    uint8_t contract_pos;           /* Object position of the contract, 1 ... 7 */
+    uint8_t next_pos;               /* Accepted Request waiting for PS_RDY */
+    uint16_t next_mv;
+    uint16_t next_ma;
+    uint16_t output_mv;             /* VBUS voltage, 0 = off */
+    uint16_t output_ma;             /* Contract current */
+    uint32_t contract_us;           /* Time of the first PS_RDY */
+} PD_source_sim_t;
+
+void PD_source_sim_init(PD_source_sim_t *src, FUSB302_sim_t *sim, const PD_source_profile_t *profile);
+void PD_source_sim_attach(PD_source_sim_t *src, uint8_t cc);
+void PD_source_sim_detach(PD_source_sim_t *src);
+void PD_source_sim_update(PD_source_sim_t *src);
+
+#endif /* PD_SOURCE_SIM_H */
@@ -231,11 +231,36 @@ enum FUSB302_transmit_data_tokens_t {
     TX_TOKEN_TXOFF   = 0xFE,
 };
 
-enum FUSB302_state_t {
-    FUSB302_STATE_UNATTACHED = 0,
-    FUSB302_STATE_ATTACHED
+enum FUSB302_attach_state_t {
+    FUSB302_ATTACH_OSC_START = 0,   /* internal oscillator starting */
+    FUSB302_ATTACH_CC1,             /* measuring CC1 */
+    FUSB302_ATTACH_CC2,             /* measuring CC2 */
+    FUSB302_ATTACH_TX_ENABLE        /* enable TX on the detected CC pin */
 };
 
+enum FUSB302_async_state_t {
+    FUSB302_ASYNC_IDLE = 0,
+    FUSB302_ASYNC_STATUS,           /* reading STATUS0A...INTERRUPT */
+    FUSB302_ASYNC_RX_HEADER,        /* reading SOP token and header */
+    FUSB302_ASYNC_RX_DATA,          /* reading data objects and CRC */
+    FUSB302_ASYNC_RX_STATUS1        /* reading STATUS1 for more packets */
+};
+
+#define FUSB302_T_OSC_START         1       /* ms for the internal oscillator to start */
+#define FUSB302_N_CC_RETRY          8       /* CC level changes tolerated before giving up on a pin */
+
+/* Time a CC level must be stable to be accepted. VBUS is already present, so the source has
+   finished its tCCDebounce and the tPDDebounce range (10...20ms) is sufficient here. */
+#ifndef FUSB302_T_CC_DEBOUNCE
+#define FUSB302_T_CC_DEBOUNCE       10
+#endif
+
+/* Low power idle: time to wait for VBUSOK after I_WAKE before powering down again.
+   The source turns VBUS on within tVBUSON (275ms) of seeing Rd. */
+#ifndef FUSB302_T_WAKE_VBUS
+#define FUSB302_T_WAKE_VBUS         500
+#endif
+
 #define FUSB302_ERR_MSG(s)  s
 
 #define REG_READ(addr, data, count) do { \
@@ -246,141 +271,413 @@ enum FUSB302_state_t {
     if (reg_write(dev, addr, data, count) != FUSB302_SUCCESS) { return FUSB302_ERR_WRITE_DEVICE; } \
 } while(0)
 
+/* Shadow register update, only marks the register dirty. Written to the device by REG_COMMIT() */
+#define REG_SET(name, value)    reg_set(dev, ADDRESS_ ## name, value)
+
+#define REG_COMMIT() do { \
+    if (reg_commit(dev) != FUSB302_SUCCESS) { return FUSB302_ERR_WRITE_DEVICE; } \
+} while(0)
+
+/* Shadow registers that can be written back: 02h...0Bh, 0Eh...0Fh
+   DEVICE_ID is read only, RESET is a command register, 0Dh is not used */
+#define REG_WRITABLE_MASK       0x67FE
+/* Clean registers bridged to merge two dirty runs into one burst.
+   A bridged register costs 1 byte, a new transaction costs address, register and START/STOP */
+#define REG_COMMIT_MAX_GAP      2
+
+#if defined(FUSB302_STATS)
+static inline uint32_t stats_clock(FUSB302_dev_t *dev)
+{
+    return dev->clock_us ? dev->clock_us() : 0;
+}
+
+#define STATS_ENTER(id) \
+    uint8_t stats_scope = dev->stats_scope; \
+    uint32_t stats_time = stats_clock(dev); \
+    dev->stats_scope = id; \
+    dev->stats[id].calls++
+
+#define STATS_LEAVE(id) do { \
+    dev->stats[id].time_us += stats_clock(dev) - stats_time; \
+    dev->stats_scope = stats_scope; \
+} while(0)
+
+#define STATS_XFER(count) do { \
+    dev->stats[dev->stats_scope].transactions++; \
+    dev->stats[dev->stats_scope].bytes += count; \
+} while(0)
+#else
+#define STATS_ENTER(id)
+#define STATS_LEAVE(id)
+#define STATS_XFER(count)
+#endif
+
 static inline FUSB302_ret_t reg_read(FUSB302_dev_t *dev, uint8_t address, uint8_t *data, uint8_t count)
 {
-    FUSB302_ret_t ret = dev->i2c_read(dev->i2c_address, address, data, count);
+    FUSB302_ret_t ret = dev->i2c_read(dev->context, dev->i2c_address, address, data, count);
+    STATS_XFER(count);
     if (ret != FUSB302_SUCCESS) {
         dev->err_msg = FUSB302_ERR_MSG("Fail to read register");
     }
     return ret;
 }
 
+static inline FUSB302_ret_t reg_read_packet(FUSB302_dev_t *dev, uint8_t *data, uint8_t count)
+{
+    FUSB302_ret_t ret = dev->i2c_read_packet(dev->context, dev->i2c_address, ADDRESS_FIFOS, data, count);
+    /* a failed read is still a transaction, its length is unknown */
+    STATS_XFER(ret == FUSB302_SUCCESS ? FUSB302_rx_packet_length(data) : 0);
+    if (ret != FUSB302_SUCCESS) {
+        dev->err_msg = FUSB302_ERR_MSG("Fail to read packet");
+    }
+    return ret;
+}
+
 static inline FUSB302_ret_t reg_write(FUSB302_dev_t *dev, uint8_t address, uint8_t *data, uint8_t count)
 {
-    FUSB302_ret_t ret = dev->i2c_write(dev->i2c_address, address, data, count);
+    STATS_XFER(count);
+    FUSB302_ret_t ret = dev->i2c_write(dev->context, dev->i2c_address, address, data, count);
     if (ret != FUSB302_SUCCESS) {
         dev->err_msg = FUSB302_ERR_MSG("Fail to write register");
     }
     return ret;
 }
 
-static FUSB302_ret_t FUSB302_read_cc_lvl(FUSB302_dev_t *dev, uint8_t * cc_value)
+static inline void reg_set(FUSB302_dev_t *dev, uint8_t address, uint8_t value)
+{
+    uint8_t i = address - ADDRESS_DEVICE_ID;
+    if (dev->reg_control[i] != value) {
+        dev->reg_control[i] = value;
+        dev->reg_dirty |= (uint16_t)1 << i;
+    }
+}
+
+static FUSB302_ret_t reg_commit(FUSB302_dev_t *dev)
+{
+    uint16_t dirty = dev->reg_dirty & REG_WRITABLE_MASK;
+    while (dirty) {
+        uint8_t first = 0, last, i;
+        while ((dirty & ((uint16_t)1 << first)) == 0) {
+            first++;
+        }
+        last = first;
+        for (i = first + 1; i < sizeof(dev->reg_control) && (REG_WRITABLE_MASK & ((uint16_t)1 << i)); i++) {
+            if (dirty & ((uint16_t)1 << i)) {
+                last = i;
+            } else if (i - last > REG_COMMIT_MAX_GAP) {
+                break;
+            }
+        }
+        if (reg_write(dev, ADDRESS_DEVICE_ID + first, &dev->reg_control[first], last - first + 1) != FUSB302_SUCCESS) {
+            return FUSB302_ERR_WRITE_DEVICE;    /* keep dirty bits for the next commit */
+        }
+        for (i = first; i <= last; i++) {
+            dirty &= ~((uint16_t)1 << i);
+        }
+        dev->reg_dirty = dirty;
+    }
+    dev->reg_dirty = 0;
+    return FUSB302_SUCCESS;
+}
+
+static FUSB302_ret_t FUSB302_sample_cc_lvl(FUSB302_dev_t *dev, uint8_t * cc_value)
 {
     /*  00: < 200 mV          : vRa
         01: >200 mV, <660 mV  : vRd-USB
         10: >660 mV, <1.23 V  : vRd-1.5
         11: >1.23 V           : vRd-3.0  */
-    uint8_t cc, cc_verify;
-    REG_READ(ADDRESS_STATUS0, &REG_STATUS0, 1);
-    cc = REG_STATUS0 & BC_LVL_MASK;
-    for (uint8_t i = 0; i < 5; i++) {
-        REG_READ(ADDRESS_STATUS0, &REG_STATUS0, 1);
-        cc_verify = REG_STATUS0 & BC_LVL_MASK;
-        if (cc != cc_verify) {
-            return FUSB302_BUSY;
-        }
+    /* One burst of STATUS0, STATUS1 and INTERRUPT: level and whether it changed since the last read */
+    REG_READ(ADDRESS_STATUS0, &REG_STATUS0, 3);
+    *cc_value = REG_STATUS0 & BC_LVL_MASK;
+    if (REG_INTERRUPT & (I_BC_LVL | I_COMP_CHNG)) {
+        return FUSB302_BUSY;
     }
-    *cc_value = cc;
 	return FUSB302_SUCCESS;
 }
 
-static FUSB302_ret_t FUSB302_read_incoming_packet(FUSB302_dev_t *dev, FUSB302_event_t * events)
+static FUSB302_ret_t FUSB302_read_cc_lvl(FUSB302_dev_t *dev, uint8_t * cc_value)
 {
-    uint8_t len, b[3];
-    REG_READ(ADDRESS_FIFOS, b, 3);
-    dev->rx_header = ((uint16_t)b[2] << 8) | b[1];
-    len = (dev->rx_header >> 12) & 0x7;
-    REG_READ(ADDRESS_FIFOS, dev->rx_buffer, len * 4 + 4);  /* add 4 to len to read CRC out */
+    FUSB302_ret_t ret;
+    STATS_ENTER(FUSB302_STATS_READ_CC_LVL);
+    ret = FUSB302_sample_cc_lvl(dev, cc_value);
+    STATS_LEAVE(FUSB302_STATS_READ_CC_LVL);
+    return ret;
+}
+
+static void FUSB302_timer_start(FUSB302_dev_t *dev, uint16_t ms)
+{
+    if (dev->clock_us) {
+        dev->timer_start = dev->clock_us();
+        dev->timer_ms = ms;
+    } else {
+        dev->delay_ms(ms);  /* no time base, fall back to blocking */
+        dev->timer_ms = 0;
+    }
+}
+
+static uint8_t FUSB302_timer_expired(FUSB302_dev_t *dev)
+{
+    if (dev->timer_ms && (uint32_t)(dev->clock_us() - dev->timer_start) < (uint32_t)dev->timer_ms * 1000) {
+        return 0;
+    }
+    dev->timer_ms = 0;
+    return 1;
+}
+
+#define RX_QUEUE_MASK   (FUSB302_RX_QUEUE_SIZE - 1)
+
+/* RX FIFO has a packet and the queue has room for it */
+static inline uint8_t FUSB302_rx_ready(FUSB302_dev_t *dev)
+{
+    return (REG_STATUS1 & RX_EMPTY) == 0 && (uint8_t)(dev->rx_write - dev->rx_read) < FUSB302_RX_QUEUE_SIZE;
+}
+
+static void FUSB302_rx_push(FUSB302_dev_t *dev, const uint8_t * packet, FUSB302_event_t * events)
+{
+    FUSB302_rx_msg_t * msg = &dev->rx_queue[dev->rx_write & RX_QUEUE_MASK];
+    msg->header = ((uint16_t)packet[2] << 8) | packet[1];
+    memcpy(msg->data, &packet[3], ((msg->header >> 12) & 0x7) * 4);
+    dev->rx_write++;
 
     if (events) {
         *events |= FUSB302_EVENT_RX_SOP;
     }
+}
+
+static void FUSB302_rx_flush(FUSB302_dev_t *dev)
+{
+    uint8_t rx_flush = REG_CONTROL1 | RX_FLUSH;
+    reg_write(dev, ADDRESS_CONTROL1, &rx_flush, 1);
+}
+
+static FUSB302_ret_t FUSB302_read_incoming_packet(FUSB302_dev_t *dev, FUSB302_event_t * events)
+{
+    uint8_t b[FUSB302_RX_PACKET_MAX];
+    if (dev->i2c_read_packet) {
+        if (reg_read_packet(dev, b, sizeof(b)) != FUSB302_SUCCESS) {
+            return FUSB302_ERR_READ_DEVICE;
+        }
+    } else {
+        REG_READ(ADDRESS_FIFOS, b, 3);
+        REG_READ(ADDRESS_FIFOS, &b[3], FUSB302_rx_packet_length(b) - 3);  /* data objects and CRC */
+    }
+    FUSB302_rx_push(dev, b, events);
+    return FUSB302_SUCCESS;
+}
+
+static FUSB302_ret_t FUSB302_state_attaching(FUSB302_dev_t *dev, FUSB302_event_t * events);
+
+/* Unattached power configuration, the VBUSOK comparator running or only the wake circuit.
+   Either way attach is signalled on INT by I_VBUSOK or I_WAKE. */
+static void FUSB302_set_idle_power(FUSB302_dev_t *dev)
+{
+    if (dev->low_power) {
+        REG_SET(CONTROL2, REG_CONTROL2 | WAKE_EN);
+        REG_SET(MASK, REG_MASK & ~M_WAKE);
+        REG_SET(POWER, PWR_BANDGAP);
+    } else {
+        REG_SET(CONTROL2, REG_CONTROL2 & ~WAKE_EN);
+        REG_SET(MASK, REG_MASK | M_WAKE);
+        REG_SET(POWER, PWR_BANDGAP | PWR_RECEIVER | PWR_MEASURE);
+    }
+}
+
+static FUSB302_ret_t FUSB302_detach_reset(FUSB302_dev_t *dev)
+{
+    /* reset cc pins to pull down */
+    REG_SET(SWITCHES0, PDWN1 | PDWN2);
+    REG_SET(SWITCHES1, SPECREV0);
+    REG_SET(MEASURE, 49);
+
+    /* turn off internal oscillator and CC level interrupts, VBUSOK is the attach signal again */
+    REG_SET(MASK, (REG_MASK | M_BC_LVL | M_COMP_CHNG) & ~M_VBUSOK);
+    FUSB302_set_idle_power(dev);
+    REG_COMMIT();
+
+    /* INTERRUPTA and INTERRUPTB, reading clears a latched TX result that would hold INT low */
+    REG_READ(ADDRESS_INTERRUPTA, &REG_INTERRUPTA, 2);
+    dev->interrupta = 0;
+    dev->interruptb = 0;
+
+    dev->vbus_sense = 1;
+    dev->timer_ms = 0;
+    dev->rx_read = dev->rx_write;
+    dev->state = FUSB302_STATE_UNATTACHED;
     return FUSB302_SUCCESS;
 }
 
 static FUSB302_ret_t FUSB302_state_unattached(FUSB302_dev_t *dev, FUSB302_event_t * events)
 {
-    REG_READ(ADDRESS_STATUS0, &REG_STATUS0, 1);
+    /* INTERRUPTA ... INTERRUPT, reading releases INT, also after a TX that completed after detach */
+    REG_READ(ADDRESS_INTERRUPTA, &REG_INTERRUPTA, 5);
     if (REG_STATUS0 & VBUSOK) {
-        /* enable internal oscillator */
-        REG_POWER = PWR_BANDGAP | PWR_RECEIVER | PWR_MEASURE | PWR_INT_OSC;
-        REG_WRITE(ADDRESS_POWER, &REG_POWER, 1);
-        dev->delay_ms(1);
-
-        /* read cc1 */
-        REG_SWITCHES0 = PDWN1 | PDWN2 | MEAS_CC1;
-        REG_SWITCHES1 = SPECREV0;
-        REG_MEASURE = 49;
-        REG_WRITE(ADDRESS_SWITCHES0, &REG_SWITCHES0, 3);
-        dev->delay_ms(1);
-        while (FUSB302_read_cc_lvl(dev, &dev->cc1) != FUSB302_SUCCESS) {
-            dev->delay_ms(1);
+        /* enable internal oscillator and CC level interrupts for debounce */
+        REG_SET(MASK, REG_MASK & ~(M_BC_LVL | M_COMP_CHNG));
+        REG_SET(POWER, PWR_BANDGAP | PWR_RECEIVER | PWR_MEASURE | PWR_INT_OSC);
+        REG_COMMIT();
+        dev->state = FUSB302_STATE_ATTACHING;
+        dev->attach_state = FUSB302_ATTACH_OSC_START;
+        FUSB302_timer_start(dev, FUSB302_T_OSC_START);
+        return FUSB302_state_attaching(dev, events);
+    }
+    if (dev->low_power) {
+        if (REG_INTERRUPT & I_WAKE) {
+            /* partner on CC, power the VBUSOK comparator and wait for I_VBUSOK */
+            REG_SET(POWER, PWR_BANDGAP | PWR_RECEIVER | PWR_MEASURE);
+            REG_COMMIT();
+            if (dev->clock_us) {
+                FUSB302_timer_start(dev, FUSB302_T_WAKE_VBUS);
+            }
+        } else if (dev->timer_ms && FUSB302_timer_expired(dev)) {
+            /* no VBUS, woken by noise or a partner without power */
+            FUSB302_set_idle_power(dev);
+            REG_COMMIT();
         }
+    }
+    return FUSB302_SUCCESS;
+}
 
-        /* read cc2 */
-        REG_SWITCHES0 = PDWN1 | PDWN2 | MEAS_CC2;
-        REG_WRITE(ADDRESS_SWITCHES0, &REG_SWITCHES0, 1);
-        dev->delay_ms(1);
-        while (FUSB302_read_cc_lvl(dev, &dev->cc2) != FUSB302_SUCCESS) {
-            dev->delay_ms(1);
+static FUSB302_ret_t FUSB302_measure_cc(FUSB302_dev_t *dev, uint8_t * cc_value)
+{
+    /* Accept the CC level once stable for FUSB302_T_CC_DEBOUNCE. One read per call, the debounce
+       restarts on I_BC_LVL / I_COMP_CHNG. Returns FUSB302_BUSY while debouncing. */
+    uint8_t cc;
+    FUSB302_ret_t ret = FUSB302_read_cc_lvl(dev, &cc);
+    if (ret != FUSB302_SUCCESS && ret != FUSB302_BUSY) {
+        return ret;
+    }
+    if (dev->attach_retry == 0 || ret == FUSB302_BUSY || cc != *cc_value) {
+        if (++dev->attach_retry > FUSB302_N_CC_RETRY) {
+            *cc_value = 0;  /* noisy CC line, treat as open */
+            dev->attach_retry = 0;
+            return FUSB302_SUCCESS;
         }
+        *cc_value = cc;
+        FUSB302_timer_start(dev, FUSB302_T_CC_DEBOUNCE);
+        return FUSB302_BUSY;
+    }
+    if (FUSB302_timer_expired(dev)) {
+        dev->attach_retry = 0;
+        return FUSB302_SUCCESS;
+    }
+    return FUSB302_BUSY;
+}
 
-        /* clear interrupt */
-        REG_READ(ADDRESS_INTERRUPTA, &REG_INTERRUPTA, 2);
-        dev->interrupta = 0;
-        dev->interruptb = 0;        
-
-        /* enable tx on cc pin */
-        if (dev->cc1 > 0) {
-            REG_SWITCHES0 = PDWN1 | PDWN2 | MEAS_CC1;
-            REG_SWITCHES1 = SPECREV0 | AUTO_CRC | TXCC1;
-            //REG_SWITCHES1 = SPECREV0 | TXCC1;
-        } else if (dev->cc2 > 0) {
-            REG_SWITCHES0 = PDWN1 | PDWN2 | MEAS_CC2;
-            REG_SWITCHES1 = SPECREV0 | AUTO_CRC | TXCC2;
-            //REG_SWITCHES1 = SPECREV0 | TXCC2;
-        } else {
-            REG_SWITCHES0 = PDWN1 | PDWN2;
-            REG_SWITCHES1 = SPECREV0;
-        }
-        REG_WRITE(ADDRESS_SWITCHES0, &REG_SWITCHES0, 2);
+static FUSB302_ret_t FUSB302_state_attaching(FUSB302_dev_t *dev, FUSB302_event_t * events)
+{
+    FUSB302_ret_t ret;
+    while (dev->state == FUSB302_STATE_ATTACHING) {
+        switch (dev->attach_state) {
+        case FUSB302_ATTACH_OSC_START:
+            if (!FUSB302_timer_expired(dev)) {
+                return FUSB302_SUCCESS;
+            }
+            /* read cc1 */
+            REG_SET(SWITCHES0, PDWN1 | PDWN2 | MEAS_CC1);
+            REG_SET(SWITCHES1, SPECREV0);
+            REG_SET(MEASURE, 49);
+            REG_COMMIT();
+            dev->attach_retry = 0;
+            dev->attach_state = FUSB302_ATTACH_CC1;
+            break;
 
-        /* update state */
-        dev->state = FUSB302_STATE_ATTACHED;
-        if (events) {
-            *events |= FUSB302_EVENT_ATTACHED;
+        case FUSB302_ATTACH_CC1:
+        case FUSB302_ATTACH_CC2:
+            ret = FUSB302_measure_cc(dev, dev->attach_state == FUSB302_ATTACH_CC1 ? &dev->cc1 : &dev->cc2);
+            if (dev->vbus_sense && (REG_STATUS0 & VBUSOK) == 0) {
+                return FUSB302_detach_reset(dev);   /* VBUS gone before attach completed */
+            }
+            if (ret == FUSB302_BUSY && dev->timer_ms == 0) {
+                break;  /* no time base, debounce time already waited in delay_ms */
+            }
+            if (ret != FUSB302_SUCCESS) {
+                if (ret == FUSB302_BUSY) {
+                    return FUSB302_SUCCESS;
+                }
+                return ret;
+            }
+            if (dev->attach_state == FUSB302_ATTACH_CC1) {
+                /* read cc2 */
+                REG_SET(SWITCHES0, PDWN1 | PDWN2 | MEAS_CC2);
+                REG_COMMIT();
+                dev->attach_state = FUSB302_ATTACH_CC2;
+            } else {
+                dev->attach_state = FUSB302_ATTACH_TX_ENABLE;
+            }
+            break;
+
+        case FUSB302_ATTACH_TX_ENABLE:
+        default:
+            /* clear interrupt */
+            REG_READ(ADDRESS_INTERRUPTA, &REG_INTERRUPTA, 2);
+            dev->interrupta = 0;
+            dev->interruptb = 0;        
+            dev->rx_read = dev->rx_write;
+
+            /* enable tx on cc pin */
+            if (dev->cc1 > 0) {
+                REG_SET(SWITCHES0, PDWN1 | PDWN2 | MEAS_CC1);
+                REG_SET(SWITCHES1, SPECREV0 | AUTO_CRC | TXCC1);
+                //REG_SET(SWITCHES1, SPECREV0 | TXCC1);
+            } else if (dev->cc2 > 0) {
+                REG_SET(SWITCHES0, PDWN1 | PDWN2 | MEAS_CC2);
+                REG_SET(SWITCHES1, SPECREV0 | AUTO_CRC | TXCC2);
+                //REG_SET(SWITCHES1, SPECREV0 | TXCC2);
+            } else {
+                REG_SET(SWITCHES0, PDWN1 | PDWN2);
+                REG_SET(SWITCHES1, SPECREV0);
+            }
+            REG_SET(MASK, REG_MASK | M_BC_LVL | M_COMP_CHNG);
+            REG_COMMIT();
+
+            /* update state */
+            dev->state = FUSB302_STATE_ATTACHED;
+            if (events) {
+                *events |= FUSB302_EVENT_ATTACHED;
+            }
+            break;
         }
     }
     return FUSB302_SUCCESS;
 }
 
-static FUSB302_ret_t FUSB302_state_attached(FUSB302_dev_t *dev, FUSB302_event_t * events)
+/* Handle STATUS0A...INTERRUPT, return FUSB302_BUSY if the RX FIFO must not be read */
+static FUSB302_ret_t FUSB302_attached_status(FUSB302_dev_t *dev, FUSB302_event_t * events)
 {
-    REG_READ(ADDRESS_STATUS0A, &REG_STATUS0A, 7);
     dev->interrupta |= REG_INTERRUPTA;
     dev->interruptb |= REG_INTERRUPTB;    
     if (dev->vbus_sense && ((REG_STATUS0 & VBUSOK) == 0)) {
-        /* reset cc pins to pull down */
-        REG_SWITCHES0 = PDWN1 | PDWN2;
-        REG_SWITCHES1 = SPECREV0;
-        REG_MEASURE = 49;
-        REG_WRITE(ADDRESS_SWITCHES0, &REG_SWITCHES0, 3);
-
-        /* turn off internal oscillator */
-        REG_POWER = PWR_BANDGAP | PWR_RECEIVER | PWR_MEASURE;
-        REG_WRITE(ADDRESS_POWER, &REG_POWER, 1);
-
-        /* update state */
-        dev->state = FUSB302_STATE_UNATTACHED;
+        if (FUSB302_detach_reset(dev) != FUSB302_SUCCESS) {
+            return FUSB302_ERR_WRITE_DEVICE;
+        }
         if (events) {
             *events |= FUSB302_EVENT_DETACHED;
         }
-        return FUSB302_SUCCESS;
+        return FUSB302_BUSY;
     }
     if (REG_STATUS0A & HARDRST) {
         uint8_t reg_control = PD_RESET;
+        dev->interrupta &= ~I_HARDRST;
         REG_WRITE(ADDRESS_RESET, &reg_control, 1);
-        return FUSB302_SUCCESS;
+        if (events) {
+            *events |= FUSB302_EVENT_HARD_RESET_RECEIVED;
+        }
+        return FUSB302_BUSY;
+    }
+    if (dev->interrupta & I_HARDSENT) {
+        uint8_t reg_control = PD_RESET;
+        dev->interrupta &= ~I_HARDSENT;
+        REG_WRITE(ADDRESS_RESET, &reg_control, 1);
+        if (events) {
+            *events |= FUSB302_EVENT_HARD_RESET_SENT;
+        }
+    }
+    if (dev->interrupta & (I_TXSENT | I_RETRYFAIL)) {
+        if (events) {
+            *events |= (dev->interrupta & I_TXSENT ? FUSB302_EVENT_TX_SUCCESS : 0) |
+                       (dev->interrupta & I_RETRYFAIL ? FUSB302_EVENT_TX_FAILED : 0);
+        }
+        dev->interrupta &= ~(I_TXSENT | I_RETRYFAIL);
     }
     if (dev->interruptb & I_GCRCSENT) {
         dev->interruptb &= ~I_GCRCSENT;
@@ -388,16 +685,32 @@ static FUSB302_ret_t FUSB302_state_attached(FUSB302_dev_t *dev, FUSB302_event_t
             *events |= FUSB302_EVENT_GOOD_CRC_SENT;
         }
     }
-    if ((REG_STATUS1 & RX_EMPTY) == 0) {
+    return FUSB302_SUCCESS;
+}
+
+static FUSB302_ret_t FUSB302_state_attached(FUSB302_dev_t *dev, FUSB302_event_t * events)
+{
+    FUSB302_ret_t ret;
+    REG_READ(ADDRESS_STATUS0A, &REG_STATUS0A, 7);
+    ret = FUSB302_attached_status(dev, events);
+    if (ret != FUSB302_SUCCESS) {
+        if (ret == FUSB302_BUSY) {
+            return FUSB302_SUCCESS;
+        }
+        return ret;
+    }
+    /* drain the RX FIFO, packets stay in the FIFO while the queue is full */
+    while (FUSB302_rx_ready(dev)) {
         if (FUSB302_read_incoming_packet(dev, events) != FUSB302_SUCCESS) {
-            uint8_t rx_flush = REG_CONTROL1 | RX_FLUSH;
-            reg_write(dev, ADDRESS_CONTROL1, &rx_flush, 1);
+            FUSB302_rx_flush(dev);
+            break;
         }
+        REG_READ(ADDRESS_STATUS1, &REG_STATUS1, 1);
     }
     return FUSB302_SUCCESS;
 }
 
-FUSB302_ret_t FUSB302_init(FUSB302_dev_t *dev)
+static FUSB302_ret_t FUSB302_setup(FUSB302_dev_t *dev)
 {
     if (dev->i2c_address == 0) {
         dev->err_msg = FUSB302_ERR_MSG("Invalid i2c address");
@@ -423,8 +736,13 @@ FUSB302_ret_t FUSB302_init(FUSB302_dev_t *dev)
     }
 
     dev->state = FUSB302_STATE_UNATTACHED;
-    dev->rx_header = 0;
-    memset(dev->rx_buffer, 0, sizeof(dev->rx_buffer));
+    dev->timer_ms = 0;
+    dev->rx_read = 0;
+    dev->rx_write = 0;
+    memset(dev->rx_queue, 0, sizeof(dev->rx_queue));
+#if defined(FUSB302_ASYNC)
+    dev->async_state = FUSB302_ASYNC_IDLE;
+#endif
 
     /* restore default settings */
     REG_RESET = SW_RES;
@@ -432,44 +750,46 @@ FUSB302_ret_t FUSB302_init(FUSB302_dev_t *dev)
     
     /* fetch all R/W registers */
     REG_READ(ADDRESS_DEVICE_ID, &REG_DEVICE_ID, 15);
+    dev->reg_dirty = 0;
 
     /* configure switchs and comparators */
-    REG_SWITCHES0 = PDWN1 | PDWN2;
-    REG_SWITCHES1 = SPECREV0;
-    REG_MEASURE = 49;
-	REG_WRITE(ADDRESS_SWITCHES0, &REG_SWITCHES0, 3);
+    REG_SET(SWITCHES0, PDWN1 | PDWN2);
+    REG_SET(SWITCHES1, SPECREV0);
+    REG_SET(MEASURE, 49);
 
     /* configure auto retries */
-    REG_CONTROL3 &= ~N_RETRIES_MASK;
-    REG_CONTROL3 |= N_RETRIES(3) | AUTO_RETRY;
-    REG_WRITE(ADDRESS_CONTROL3, &REG_CONTROL3, 1);
+    REG_SET(CONTROL3, (REG_CONTROL3 & ~N_RETRIES_MASK) | N_RETRIES(3) | AUTO_RETRY);
 
     /* configure interrupt mask */
-    REG_MASK = 0xFF;
-    REG_MASK &= ~(M_VBUSOK | M_ACTIVITY | M_COLLISION | M_ALERT | M_CRC_CHK);
-    REG_WRITE(ADDRESS_MASK, &REG_MASK, 1);
+    REG_SET(MASK, 0xFF & ~(M_VBUSOK | M_ACTIVITY | M_COLLISION | M_ALERT | M_CRC_CHK));
     
     /* configure interrupt maska/maskb */
-    REG_MASKA = 0xFF;
-    REG_MASKA &= ~(M_RETRYFAIL | M_HARDSENT | M_TXSENT | M_HARDRST);
-    REG_WRITE(ADDRESS_MASKA, &REG_MASKA, 1);
-    REG_MASKB = 0xFF;
-    REG_MASKB &= ~(M_GCRCSENT);
-    REG_WRITE(ADDRESS_MASKB, &REG_MASKB, 1);
+    REG_SET(MASKA, 0xFF & ~(M_RETRYFAIL | M_HARDSENT | M_TXSENT | M_HARDRST));
+    REG_SET(MASKB, 0xFF & ~(M_GCRCSENT));
     
     /* enable interrupt */
-    REG_CONTROL0 &= ~INT_MASK;
-    REG_WRITE(ADDRESS_CONTROL0, &REG_CONTROL0, 1);
+    REG_SET(CONTROL0, REG_CONTROL0 & ~INT_MASK);
+
+    /* Power on, enable VUSB detection or wake detection in low power idle */
+    FUSB302_set_idle_power(dev);
 
-    /* Power on, enable VUSB detection */
-    REG_POWER = PWR_BANDGAP | PWR_RECEIVER | PWR_MEASURE;
-    REG_WRITE(ADDRESS_POWER, &REG_POWER, 1);
+    /* write all changed registers in as few bursts as possible */
+    REG_COMMIT();
     
     dev->vbus_sense = 1;
     dev->err_msg = FUSB302_ERR_MSG("");
 	return FUSB302_SUCCESS;
 }
 
+FUSB302_ret_t FUSB302_init(FUSB302_dev_t *dev)
+{
+    FUSB302_ret_t ret;
+    STATS_ENTER(FUSB302_STATS_INIT);
+    ret = FUSB302_setup(dev);
+    STATS_LEAVE(FUSB302_STATS_INIT);
+    return ret;
+}
+
 FUSB302_ret_t FUSB302_pd_reset(FUSB302_dev_t *dev)
 {
     uint8_t reg = PD_RESET;
@@ -479,8 +799,8 @@ FUSB302_ret_t FUSB302_pd_reset(FUSB302_dev_t *dev)
 
 FUSB302_ret_t FUSB302_pdwn_cc(FUSB302_dev_t *dev, uint8_t enable)
 {
-    REG_SWITCHES0 = enable ? (PDWN1 | PDWN2) : 0;
-	REG_WRITE(ADDRESS_SWITCHES0, &REG_SWITCHES0, 1);
+    REG_SET(SWITCHES0, enable ? (PDWN1 | PDWN2) : 0);
+	REG_COMMIT();
     return FUSB302_SUCCESS;
 }
 
@@ -488,16 +808,29 @@ FUSB302_ret_t FUSB302_set_vbus_sense(FUSB302_dev_t *dev, uint8_t enable)
 {
     if (dev->vbus_sense != enable) {
         if (enable) {
-            REG_MASK &= ~M_VBUSOK;  /* enable VBUSOK interrupt */
+            REG_SET(MASK, REG_MASK & ~M_VBUSOK);    /* enable VBUSOK interrupt */
         } else { 
-            REG_MASK |= M_VBUSOK;   /* disable VBUSOK interrupt */
+            REG_SET(MASK, REG_MASK | M_VBUSOK);     /* disable VBUSOK interrupt */
         }
-        REG_WRITE(ADDRESS_MASK, &REG_MASK, 1);
+        REG_COMMIT();
         dev->vbus_sense = enable;
     }
     return FUSB302_SUCCESS;
 }
 
+FUSB302_ret_t FUSB302_set_low_power(FUSB302_dev_t *dev, uint8_t enable)
+{
+    if (dev->low_power != enable) {
+        dev->low_power = enable;
+        if (dev->state == FUSB302_STATE_UNATTACHED) {
+            FUSB302_set_idle_power(dev);
+            REG_COMMIT();
+            dev->timer_ms = 0;
+        }
+    }
+    return FUSB302_SUCCESS;
+}
+
 FUSB302_ret_t FUSB302_get_ID(FUSB302_dev_t *dev, uint8_t * version_ID, uint8_t * revision_ID)
 {
     if (dev && (REG_DEVICE_ID & 0x80)) {
@@ -533,21 +866,33 @@ FUSB302_ret_t FUSB302_get_vbus_level(FUSB302_dev_t *dev, uint8_t *vbus)
 
 FUSB302_ret_t FUSB302_get_message(FUSB302_dev_t *dev, uint16_t * header, uint32_t * data)
 {
+    const FUSB302_rx_msg_t * msg = &dev->rx_queue[dev->rx_read & RX_QUEUE_MASK];
+    if (dev->rx_read == dev->rx_write) {
+        return FUSB302_BUSY;
+    }
     if (header) {
-        *header = dev->rx_header;
+        *header = msg->header;
     }
     if (data) {
-        uint8_t len = (dev->rx_header >> 12) & 0x7;
-        memcpy(data, dev->rx_buffer, len * 4);
+        uint8_t len = (msg->header >> 12) & 0x7;
+        memcpy(data, msg->data, len * 4);
     }
+    dev->rx_read++;
 	return FUSB302_SUCCESS;
 }
 
 FUSB302_ret_t FUSB302_tx_sop(FUSB302_dev_t *dev, uint16_t header, const uint32_t *data)
 {
+    FUSB302_ret_t ret;
     uint8_t buf[40];
     uint8_t * pbuf = buf;
     uint8_t obj_count = ((header >> 12) & 7);
+#if defined(FUSB302_ASYNC)
+    if (dev->async_state != FUSB302_ASYNC_IDLE) {
+        return FUSB302_BUSY;    /* bus in use by FUSB302_alert_async() */
+    }
+#endif
+    STATS_ENTER(FUSB302_STATS_TX_SOP);
     *pbuf++ = (uint8_t)TX_TOKEN_SOP1;
     *pbuf++ = (uint8_t)TX_TOKEN_SOP1;
     *pbuf++ = (uint8_t)TX_TOKEN_SOP1;
@@ -566,9 +911,10 @@ FUSB302_ret_t FUSB302_tx_sop(FUSB302_dev_t *dev, uint16_t header, const uint32_t
     *pbuf++ = (uint8_t)TX_TOKEN_EOP;
     *pbuf++ = (uint8_t)TX_TOKEN_TXOFF;
     *pbuf++ = (uint8_t)TX_TOKEN_TXON;
-    REG_WRITE(ADDRESS_FIFOS, buf, pbuf - buf);
-    dev->delay_ms(1);
-	return FUSB302_SUCCESS;
+    /* completion is reported by FUSB302_alert() as FUSB302_EVENT_TX_SUCCESS or FUSB302_EVENT_TX_FAILED */
+    ret = reg_write(dev, ADDRESS_FIFOS, buf, pbuf - buf);
+    STATS_LEAVE(FUSB302_STATS_TX_SOP);
+	return ret == FUSB302_SUCCESS ? FUSB302_SUCCESS : FUSB302_ERR_WRITE_DEVICE;
 }
 
 FUSB302_ret_t FUSB302_tx_hard_reset(FUSB302_dev_t *dev)
@@ -576,9 +922,7 @@ FUSB302_ret_t FUSB302_tx_hard_reset(FUSB302_dev_t *dev)
     uint8_t reg_control = REG_CONTROL3;
     reg_control |= SEND_HARDRESET;
     REG_WRITE(ADDRESS_CONTROL3, &reg_control, 1);
-    dev->delay_ms(5);
-    reg_control = PD_RESET;
-    REG_WRITE(ADDRESS_RESET, &reg_control, 1);
+    /* PD_RESET is issued by FUSB302_alert() on I_HARDSENT, reported as FUSB302_EVENT_HARD_RESET_SENT */
     return FUSB302_SUCCESS;
 }
 
@@ -586,11 +930,118 @@ FUSB302_ret_t FUSB302_alert(FUSB302_dev_t *dev, FUSB302_event_t * events)
 {
     FUSB302_ret_t (* const handler[]) (FUSB302_dev_t *, FUSB302_event_t *) = {
         FUSB302_state_unattached,
+        FUSB302_state_attaching,
         FUSB302_state_attached
     };
+    FUSB302_ret_t ret = FUSB302_SUCCESS;
+    STATS_ENTER(FUSB302_STATS_ALERT);
     if (dev->state < sizeof(handler) / sizeof(handler[0])) {
-        return handler[dev->state](dev, events);
+        ret = handler[dev->state](dev, events);
+    } else {
+        dev->state = FUSB302_STATE_UNATTACHED;
     }
-    dev->state = FUSB302_STATE_UNATTACHED;
+    STATS_LEAVE(FUSB302_STATS_ALERT);
+    return ret;
+}
+
+#if defined(FUSB302_ASYNC)
+static FUSB302_ret_t FUSB302_async_read(FUSB302_dev_t *dev, uint8_t address, uint8_t *data, uint8_t count, uint8_t next)
+{
+    FUSB302_ret_t ret;
+    STATS_XFER(count);
+    dev->async_done = 0;
+    dev->async_state = next;
+    ret = dev->i2c_read_async(dev->context, dev->i2c_address, address, data, count);
+    if (ret != FUSB302_SUCCESS) {
+        dev->async_state = FUSB302_ASYNC_IDLE;
+        dev->err_msg = FUSB302_ERR_MSG("Fail to read register");
+        return FUSB302_ERR_READ_DEVICE;
+    }
+    return FUSB302_BUSY;
+}
+
+static FUSB302_ret_t FUSB302_async_step(FUSB302_dev_t *dev, FUSB302_event_t * events)
+{
+    FUSB302_ret_t ret;
+    if (dev->async_state != FUSB302_ASYNC_IDLE) {
+        if (dev->async_done == 0) {
+            return FUSB302_BUSY;
+        }
+        if (dev->async_ret != FUSB302_SUCCESS && dev->async_state == FUSB302_ASYNC_RX_STATUS1) {
+            /* last packet is complete and the FIFO is intact, read STATUS1 again with a blocking read */
+            dev->async_state = FUSB302_ASYNC_IDLE;
+            REG_READ(ADDRESS_STATUS1, &REG_STATUS1, 1);
+            dev->async_state = FUSB302_ASYNC_RX_STATUS1;
+        } else if (dev->async_ret != FUSB302_SUCCESS) {
+            if (dev->async_state == FUSB302_ASYNC_RX_HEADER || dev->async_state == FUSB302_ASYNC_RX_DATA) {
+                FUSB302_rx_flush(dev);  /* packet partly read, the FIFO position is lost */
+            }
+            dev->async_state = FUSB302_ASYNC_IDLE;
+            dev->err_msg = FUSB302_ERR_MSG("Fail to read register");
+            return FUSB302_ERR_READ_DEVICE;
+        }
+    }
+    switch (dev->async_state) {
+    case FUSB302_ASYNC_IDLE:
+        return FUSB302_async_read(dev, ADDRESS_STATUS0A, &REG_STATUS0A, 7, FUSB302_ASYNC_STATUS);
+    case FUSB302_ASYNC_STATUS:
+        ret = FUSB302_attached_status(dev, events);
+        if (ret != FUSB302_SUCCESS) {
+            dev->async_state = FUSB302_ASYNC_IDLE;
+            if (ret == FUSB302_BUSY) {
+                return FUSB302_SUCCESS;
+            }
+            return ret;
+        }
+        /* fall through */
+    case FUSB302_ASYNC_RX_STATUS1:
+        if (FUSB302_rx_ready(dev)) {
+            return FUSB302_async_read(dev, ADDRESS_FIFOS, dev->rx_packet, 3, FUSB302_ASYNC_RX_HEADER);
+        }
+        break;
+    case FUSB302_ASYNC_RX_HEADER:
+        return FUSB302_async_read(dev, ADDRESS_FIFOS, &dev->rx_packet[3],
+            FUSB302_rx_packet_length(dev->rx_packet) - 3, FUSB302_ASYNC_RX_DATA);
+    case FUSB302_ASYNC_RX_DATA:
+        FUSB302_rx_push(dev, dev->rx_packet, events);
+        return FUSB302_async_read(dev, ADDRESS_STATUS1, &REG_STATUS1, 1, FUSB302_ASYNC_RX_STATUS1);
+    default:
+        break;
+    }
+    dev->async_state = FUSB302_ASYNC_IDLE;
     return FUSB302_SUCCESS;
 }
+
+FUSB302_ret_t FUSB302_alert_async(FUSB302_dev_t *dev, FUSB302_event_t * events)
+{
+    FUSB302_ret_t ret;
+    if (dev->i2c_read_async == 0 || (dev->async_state == FUSB302_ASYNC_IDLE && dev->state != FUSB302_STATE_ATTACHED)) {
+        return FUSB302_alert(dev, events);
+    }
+    STATS_ENTER(FUSB302_STATS_ALERT);
+    ret = FUSB302_async_step(dev, events);
+    STATS_LEAVE(FUSB302_STATS_ALERT);
+    return ret;
+}
+
+void FUSB302_i2c_done(FUSB302_dev_t *dev, FUSB302_ret_t ret)
+{
+    dev->async_ret = ret;
+    dev->async_done = 1;
+}
+#endif
+
+#if defined(FUSB302_STATS)
+const FUSB302_stats_t * FUSB302_get_stats(FUSB302_dev_t *dev, uint8_t entry)
+{
+    if (dev && entry < FUSB302_STATS_COUNT) {
+        return &dev->stats[entry];
+    }
+    return 0;
+}
+
+void FUSB302_clear_stats(FUSB302_dev_t *dev)
+{
+    memset(dev->stats, 0, sizeof(dev->stats));
+}
+#endif
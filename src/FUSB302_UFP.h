@@ -34,43 +34,148 @@ typedef uint8_t FUSB302_ret_t;
 #define FUSB302_EVENT_DETACHED          (1 << 1)
 #define FUSB302_EVENT_RX_SOP            (1 << 2)
 #define FUSB302_EVENT_GOOD_CRC_SENT     (1 << 3)
+#define FUSB302_EVENT_TX_SUCCESS        (1 << 4)    /* GoodCRC received for the last FUSB302_tx_sop() */
+#define FUSB302_EVENT_TX_FAILED         (1 << 5)    /* no GoodCRC after all retries */
+#define FUSB302_EVENT_HARD_RESET_SENT   (1 << 6)    /* FUSB302_tx_hard_reset() completed, PD logic reset */
+#define FUSB302_EVENT_HARD_RESET_RECEIVED (1 << 7)  /* hard reset from the source, PD logic reset */
 typedef uint8_t FUSB302_event_t;
 
+enum FUSB302_state_t {
+    FUSB302_STATE_UNATTACHED = 0,
+    FUSB302_STATE_ATTACHING,
+    FUSB302_STATE_ATTACHED
+};
+
+/* Received messages buffered between FUSB302_alert() and FUSB302_get_message(), power of 2 */
+#ifndef FUSB302_RX_QUEUE_SIZE
+#define FUSB302_RX_QUEUE_SIZE           4
+#endif
+
+typedef struct {
+    uint16_t header;
+    uint8_t data[28];
+} FUSB302_rx_msg_t;
+
+/* RX FIFO packet: SOP token, header, up to 7 data objects and CRC */
+#define FUSB302_RX_PACKET_MAX           35
+
+/* Packet length from the first 3 bytes read from the RX FIFO, for use in i2c_read_packet */
+static inline uint8_t FUSB302_rx_packet_length(const uint8_t *data) { return 3 + ((data[2] >> 4) & 0x7) * 4 + 4; }
+
+/* Optional I2C cost instrumentation, enable by defining FUSB302_STATS for the whole build.
+   Transactions and bytes are counted on the innermost entry point,
+   time_us is the elapsed time of each call including nested entry points. */
+#if defined(FUSB302_STATS)
+enum {
+    FUSB302_STATS_OTHER         = 0,
+    FUSB302_STATS_INIT,
+    FUSB302_STATS_ALERT,
+    FUSB302_STATS_TX_SOP,
+    FUSB302_STATS_READ_CC_LVL,
+    FUSB302_STATS_COUNT
+};
+
+typedef struct {
+    uint32_t calls;
+    uint32_t transactions;
+    uint32_t bytes;         /* data bytes, excluding device and register address */
+    uint32_t time_us;
+} FUSB302_stats_t;
+#endif
+
 typedef struct {
     /* setup by user */
     uint8_t i2c_address;
-    FUSB302_ret_t (*i2c_read)(uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
-    FUSB302_ret_t (*i2c_write)(uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
+    void *context;                  /* passed to the i2c callbacks, e.g. the bus the chip is on */
+    FUSB302_ret_t (*i2c_read)(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
+    FUSB302_ret_t (*i2c_write)(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
     FUSB302_ret_t (*delay_ms)(uint32_t t);
+    uint32_t (*clock_us)(void);     /* optional time base, without it attach blocks in delay_ms */
+    /* optional, read a RX FIFO packet in one transaction: read 3 bytes, then continue to
+       FUSB302_rx_packet_length() bytes (at most count). Without it a packet takes two reads */
+    FUSB302_ret_t (*i2c_read_packet)(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
+#if defined(FUSB302_ASYNC)
+    /* optional, start a read and return, report completion with FUSB302_i2c_done() */
+    FUSB302_ret_t (*i2c_read_async)(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
+#endif
 
     /* used by this library */
     const char * err_msg;
-    uint16_t rx_header;
-    uint8_t rx_buffer[32];
+    FUSB302_rx_msg_t rx_queue[FUSB302_RX_QUEUE_SIZE];
+    uint8_t rx_read;
+    uint8_t rx_write;
     uint8_t reg_control[15];
     uint8_t reg_status[7];
+    uint16_t reg_dirty;     /* reg_control entries changed but not written to the device */
     
     uint8_t interrupta;
     uint8_t interruptb;
     uint8_t cc1;
     uint8_t cc2;
     uint8_t state;
+    uint8_t attach_state;
+    uint8_t attach_retry;
     uint8_t vbus_sense;
+    uint8_t low_power;      /* unattached with only the wake circuit powered, see FUSB302_set_low_power() */
+    uint16_t timer_ms;
+    uint32_t timer_start;
+#if defined(FUSB302_ASYNC)
+    uint8_t rx_packet[FUSB302_RX_PACKET_MAX];
+    uint8_t async_state;
+    volatile uint8_t async_done;
+    volatile FUSB302_ret_t async_ret;
+#endif
+#if defined(FUSB302_STATS)
+    FUSB302_stats_t stats[FUSB302_STATS_COUNT];
+    uint8_t stats_scope;
+#endif
 } FUSB302_dev_t;
 
 static inline const char * FUSB302_get_last_err_msg(FUSB302_dev_t *dev) { return dev->err_msg; }
+/* Attach and detach are signalled on INT, FUSB302_alert() needs no periodic call while not attached */
+static inline uint8_t FUSB302_is_attached(FUSB302_dev_t *dev) { return dev->state == FUSB302_STATE_ATTACHED; }
+/* Non-zero when FUSB302_alert() has timed work due and must be called even without INT */
+static inline uint8_t FUSB302_timer_due(FUSB302_dev_t *dev) {
+    return dev->timer_ms && (uint32_t)(dev->clock_us() - dev->timer_start) >= (uint32_t)dev->timer_ms * 1000;
+}
+/* ms until FUSB302_timer_due(), 0xFFFF if no timer is running */
+static inline uint16_t FUSB302_timer_left_ms(FUSB302_dev_t *dev) {
+    uint32_t elapsed;
+    if (dev->timer_ms == 0) {
+        return 0xFFFF;
+    }
+    elapsed = (uint32_t)(dev->clock_us() - dev->timer_start);
+    return elapsed < (uint32_t)dev->timer_ms * 1000 ? (uint16_t)(((uint32_t)dev->timer_ms * 1000 - elapsed + 999) / 1000) : 0;
+}
+
+#if defined(FUSB302_STATS)
+const FUSB302_stats_t * FUSB302_get_stats(FUSB302_dev_t *dev, uint8_t entry);
+void FUSB302_clear_stats(FUSB302_dev_t *dev);
+#endif
 
 FUSB302_ret_t FUSB302_init            (FUSB302_dev_t *dev);
 FUSB302_ret_t FUSB302_pd_reset        (FUSB302_dev_t *dev);
 FUSB302_ret_t FUSB302_pdwn_cc         (FUSB302_dev_t *dev, uint8_t enable);
 FUSB302_ret_t FUSB302_set_vbus_sense  (FUSB302_dev_t *dev, uint8_t enable);
+FUSB302_ret_t FUSB302_set_low_power   (FUSB302_dev_t *dev, uint8_t enable);   /* call after FUSB302_init() */
 FUSB302_ret_t FUSB302_get_ID          (FUSB302_dev_t *dev, uint8_t *version_ID, uint8_t *revision_ID);
 FUSB302_ret_t FUSB302_get_cc          (FUSB302_dev_t *dev, uint8_t *cc1, uint8_t *cc2);
 FUSB302_ret_t FUSB302_get_vbus_level  (FUSB302_dev_t *dev, uint8_t *vbus);
-FUSB302_ret_t FUSB302_get_message     (FUSB302_dev_t *dev, uint16_t *header, uint32_t *data);
+FUSB302_ret_t FUSB302_get_message     (FUSB302_dev_t *dev, uint16_t *header, uint32_t *data); /* FUSB302_BUSY if queue is empty */
 FUSB302_ret_t FUSB302_tx_sop          (FUSB302_dev_t *dev, uint16_t header, const uint32_t *data);
 FUSB302_ret_t FUSB302_tx_hard_reset   (FUSB302_dev_t *dev);
 FUSB302_ret_t FUSB302_alert           (FUSB302_dev_t *dev, FUSB302_event_t *events);
 
+/* Optional split-phase alert for interrupt or DMA driven I2C, enable by defining FUSB302_ASYNC.
+   Reads of the attached state go through i2c_read_async, other states use FUSB302_alert().
+   Returns FUSB302_BUSY while a transfer is in flight, call again after FUSB302_i2c_done().
+   FUSB302_tx_sop() returns FUSB302_BUSY until FUSB302_alert_async() has finished.
+   Writes stay blocking on i2c_write: FUSB302_tx_sop(), FUSB302_tx_hard_reset(), register commits
+   and the PD_RESET after a hard reset. The detach reset also blocks, it is a write and a read. */
+#if defined(FUSB302_ASYNC)
+FUSB302_ret_t FUSB302_alert_async     (FUSB302_dev_t *dev, FUSB302_event_t *events);
+void FUSB302_i2c_done                 (FUSB302_dev_t *dev, FUSB302_ret_t ret);  /* transfer completed, ISR safe */
+#endif
+
 #endif /* FUSB302_H */
 
@@ -7,7 +7,8 @@
  *
  * Minimalist USB PD Ardunio Library for PD Micro board
  * Only support UFP(device) sink only functionality
- * Requires FUSB302_UFP.h, PD_UFP_Protocol.h and Standard Arduino Library
+ * Requires FUSB302_UFP.h, PD_UFP_Protocol.h and Standard Arduino Library,
+ * or a PD_UFP_HAL_t for other platforms, see PD_UFP_HAL.h
  *
  * Support PD3.0 PPS
  * 
@@ -18,26 +19,16 @@
 
 #include "PD_UFP.h"
 
-#define t_PD_POLLING            100
-#define t_TypeCSinkWaitCap      350
-#define t_RequestToPSReady      580     // combine t_SenderResponse and t_PSTransition
-#define t_PPSRequest            5000    // must less than 10000 (10s)
+// Timing in ms, see PD_UFP_Config.h
+#define t_PD_POLLING            PD_UFP_T_POLLING
+#define t_TypeCSinkWaitCap      PD_UFP_T_SINK_WAIT_CAP
+#define t_RequestToPSReady      PD_UFP_T_REQUEST_TO_PS_READY
+#define t_PPSRequest            PD_UFP_T_PPS_REQUEST
+#define t_PPSRegulate           PD_UFP_T_PPS_REGULATE
+#define t_ResponseDelay         PD_UFP_T_RESPONSE_DELAY     // wait for retransmission before respond
 
 #define PIN_FUSB302_INT         12
 
-enum {
-    STATUS_LOG_MSG_TX,
-    STATUS_LOG_MSG_RX,
-    STATUS_LOG_DEV,
-    STATUS_LOG_CC,
-    STATUS_LOG_SRC_CAP,
-    STATUS_LOG_POWER_READY,
-    STATUS_LOG_POWER_PPS_STARTUP,
-    STATUS_LOG_POWER_REJECT,
-    STATUS_LOG_LOAD_SW_ON,
-    STATUS_LOG_LOAD_SW_OFF,
-};
-
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // PD_UFP_c
@@ -45,76 +36,188 @@ enum {
 PD_UFP_c::PD_UFP_c():
     ready_voltage(0),
     ready_current(0),
+#if PD_UFP_PPS
     PPS_voltage_next(0),
     PPS_current_next(0),
+    PPS_voltage_pending(0),
+    PPS_current_pending(0),
+    PPS_pending(0),
+#endif
+#if PD_UFP_PPS_STATUS
+    PPS_regulate_voltage(0),
+    PPS_regulate_cable_mohm(0),
+#endif
     status_initialized(0),
     status_src_cap_received(0),
+    status_contract(0),
     status_power(STATUS_POWER_NA),
     time_polling(0),
     time_wait_src_cap(0),
     time_wait_ps_rdy(0),
+#if PD_UFP_PPS
     time_PPS_request(0),
+#endif
+#if PD_UFP_PPS_STATUS
+    time_PPS_regulate(0),
+#endif
+    time_respond(0),
+    time_request_retry(0),
+    tx_header(0),
     get_src_cap_retry_count(0),
     wait_src_cap(0),
     wait_ps_rdy(0),
-    send_request(0)
+    wait_respond(0),
+    send_request(0),
+    request_retry(0),
+    tx_busy(0)
 {
     memset(&FUSB302, 0, sizeof(FUSB302_dev_t));
     memset(&protocol, 0, sizeof(PD_protocol_t));
+#if defined(ARDUINO)
+    set_i2c(Wire);
+#endif
 }
 
 void PD_UFP_c::init(uint8_t int_pin, enum PD_power_option_t power_option)
-{
-    init_PPS(int_pin, 0, 0, power_option);
-}
-
-void PD_UFP_c::init_PPS(uint8_t int_pin, uint16_t PPS_voltage, uint8_t PPS_current, enum PD_power_option_t power_option)
 {
     this->int_pin = int_pin;
     // Initialize FUSB302
-    pinMode(int_pin, INPUT_PULLUP); // Set FUSB302 int pin input ant pull up
-    FUSB302.i2c_address = 0x22;
-    FUSB302.i2c_read = FUSB302_i2c_read;
-    FUSB302.i2c_write = FUSB302_i2c_write;
+    hal->pin_init(int_pin); // Set FUSB302 int pin input ant pull up
+    FUSB302.i2c_read = hal->i2c_read;
+    FUSB302.i2c_write = hal->i2c_write;
     FUSB302.delay_ms = FUSB302_delay_ms;
+    FUSB302.clock_us = FUSB302_clock_us;
     if (FUSB302_init(&FUSB302) == FUSB302_SUCCESS && FUSB302_get_ID(&FUSB302, 0, 0) == FUSB302_SUCCESS) {
         status_initialized = 1;
     }
 
+    // Initialize PD protocol engine
+    PD_protocol_init(&protocol);
+    PD_protocol_set_power_option(&protocol, power_option);
+
+    status_log_event(STATUS_LOG_DEV);
+}
+
+#if PD_UFP_PPS
+void PD_UFP_c::init_PPS(uint8_t int_pin, uint16_t PPS_voltage, uint8_t PPS_current, enum PD_power_option_t power_option)
+{
+    init(int_pin, power_option);
+
     // Two stage startup for PPS Voltge < 5V
     if (PPS_voltage && PPS_voltage < PPS_V(5.0)) {
         PPS_voltage_next = PPS_voltage;
         PPS_current_next = PPS_current;
         PPS_voltage = PPS_V(5.0);
     }
-
-    // Initialize PD protocol engine
-    PD_protocol_init(&protocol);
-    PD_protocol_set_power_option(&protocol, power_option);
     PD_protocol_set_PPS(&protocol, PPS_voltage, PPS_current, false);
-
-    status_log_event(STATUS_LOG_DEV);
 }
+#endif
 
-void PD_UFP_c::run(void)
+uint16_t PD_UFP_c::run(void)
 {
-    if (timer() || digitalRead(int_pin) == 0) {
+    if (timer() || hal->pin_read(int_pin) == 0 || FUSB302_timer_due(&FUSB302)) {
         FUSB302_event_t FUSB302_events = 0;
         for (uint8_t i = 0; i < 3 && FUSB302_alert(&FUSB302, &FUSB302_events) != FUSB302_SUCCESS; i++) {}
         if (FUSB302_events) {
             handle_FUSB302_event(FUSB302_events);
         }
     }
+    return hal->pin_read(int_pin) == 0 ? 0 : next_wakeup_ms();
+}
+
+static uint16_t time_left(uint16_t t, uint16_t start, uint16_t period)
+{
+    uint16_t elapsed = t - start;
+    return elapsed < period ? period - elapsed : 0;
+}
+
+uint16_t PD_UFP_c::next_wakeup_ms(void)
+{
+    /* Deadlines checked in timer(), ">" comparisons are due one ms after the period */
+    uint16_t t = clock_ms();
+    uint16_t next = FUSB302_is_attached(&FUSB302) ? time_left(t, time_polling, t_PD_POLLING + 1) : 0xFFFF;
+    uint16_t left = FUSB302_timer_left_ms(&FUSB302);
+    next = left < next ? left : next;
+    if (wait_respond && !tx_busy) {
+        left = time_left(t, time_respond, t_ResponseDelay);
+        next = left < next ? left : next;
+    }
+    if (wait_src_cap && !tx_busy) {
+        left = time_left(t, time_wait_src_cap, t_TypeCSinkWaitCap + 1);
+        next = left < next ? left : next;
+    }
+    if (wait_ps_rdy) {
+        left = time_left(t, time_wait_ps_rdy, t_RequestToPSReady + 1);
+        next = left < next ? left : next;
+    } else if (request_retry) {
+        left = time_left(t, time_request_retry, t_PD_POLLING + 1);
+        next = left < next ? left : next;
+    } else if (tx_busy) {
+        /* Next message after the TX interrupt */
+    } else if (send_request) {
+        next = 0;
+    }
+#if PD_UFP_PPS
+    else if (PPS_pending) {
+        next = 0;
+    } else if (status_power == STATUS_POWER_PPS) {
+        left = time_left(t, time_PPS_request, t_PPSRequest + 1);
+        next = left < next ? left : next;
+#if PD_UFP_PPS_STATUS
+        if (PPS_regulate_voltage) {
+            left = time_left(t, time_PPS_regulate, t_PPSRegulate + 1);
+            next = left < next ? left : next;
+        }
+#endif
+    }
+#endif
+    return next / clock_prescaler;
+}
+
+void PD_UFP_c::set_low_power_idle(bool enable)
+{
+    FUSB302_set_low_power(&FUSB302, enable ? 1 : 0);
 }
 
+void PD_UFP_c::set_i2c(void * context, uint8_t address)
+{
+    FUSB302.context = context;
+    FUSB302.i2c_address = address;
+}
+
+#if PD_UFP_PPS
 bool PD_UFP_c::set_PPS(uint16_t PPS_voltage, uint8_t PPS_current)
 {
-    if (status_power == STATUS_POWER_PPS && PD_protocol_set_PPS(&protocol, PPS_voltage, PPS_current, true)) {
+    if (status_power != STATUS_POWER_PPS) {
+        return false;
+    }
+    if (wait_ps_rdy) {
+        /* Request in flight, keep the latest setpoint and send it from timer() after PS_RDY */
+        if (PD_protocol_check_PPS(&protocol, PPS_voltage, PPS_current)) {
+            PPS_voltage_pending = PPS_voltage;
+            PPS_current_pending = PPS_current;
+            PPS_pending = 1;
+            return true;
+        }
+        return false;
+    }
+    PPS_pending = 0;
+    if (PD_protocol_set_PPS(&protocol, PPS_voltage, PPS_current, true)) {
         send_request = 1;
         return true;
     }
     return false;
 }
+#endif
+
+#if PD_UFP_PPS_STATUS
+void PD_UFP_c::set_PPS_regulation(uint16_t voltage, uint16_t cable_mohm)
+{
+    PPS_regulate_voltage = voltage;
+    PPS_regulate_cable_mohm = cable_mohm;
+    time_PPS_regulate = clock_ms();
+}
+#endif
 
 void PD_UFP_c::set_power_option(enum PD_power_option_t power_option)
 {
@@ -123,6 +226,13 @@ void PD_UFP_c::set_power_option(enum PD_power_option_t power_option)
     }
 }
 
+void PD_UFP_c::set_power_policy(const PD_power_policy_t & policy)
+{
+    if (PD_protocol_set_power_policy(&protocol, &policy)) {
+        send_request = 1;
+    }
+}
+
 void PD_UFP_c::clock_prescale_set(uint8_t prescaler)
 {
     if (prescaler) {
@@ -130,35 +240,20 @@ void PD_UFP_c::clock_prescale_set(uint8_t prescaler)
     }
 }
 
-FUSB302_ret_t PD_UFP_c::FUSB302_i2c_read(uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count)
+void PD_UFP_c::set_hal(const PD_UFP_HAL_t & hal)
 {
-    Wire.beginTransmission(dev_addr);
-    Wire.write(reg_addr);
-    Wire.endTransmission();
-    Wire.requestFrom(dev_addr, count);
-    while (Wire.available() && count > 0) {
-        *data++ = Wire.read();
-        count--;
-    }
-    return count == 0 ? FUSB302_SUCCESS : FUSB302_ERR_READ_DEVICE;
+    PD_UFP_c::hal = &hal;
 }
 
-FUSB302_ret_t PD_UFP_c::FUSB302_i2c_write(uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count)
+FUSB302_ret_t PD_UFP_c::FUSB302_delay_ms(uint32_t t)
 {
-    Wire.beginTransmission(dev_addr);
-    Wire.write(reg_addr);
-    while (count > 0) {
-        Wire.write(*data++);
-        count--;
-    }
-    Wire.endTransmission();
+    hal->delay_ms(t / clock_prescaler);
     return FUSB302_SUCCESS;
 }
 
-FUSB302_ret_t PD_UFP_c::FUSB302_delay_ms(uint32_t t)
+uint32_t PD_UFP_c::FUSB302_clock_us(void)
 {
-    delay(t / clock_prescaler);
-    return FUSB302_SUCCESS;
+    return hal->clock_us() * clock_prescaler;
 }
 
 void PD_UFP_c::handle_protocol_event(PD_protocol_event_t events)
@@ -174,6 +269,10 @@ void PD_UFP_c::handle_protocol_event(PD_protocol_event_t events)
         if (wait_ps_rdy) {
             wait_ps_rdy = 0;
             status_log_event(STATUS_LOG_POWER_REJECT);
+            if (!status_contract) {
+                /* No explicit contract, stay at vSafe5V */
+                set_default_power();
+            }
         }
     }    
     if (events & PD_PROTOCOL_EVENT_PS_RDY) {
@@ -181,6 +280,8 @@ void PD_UFP_c::handle_protocol_event(PD_protocol_event_t events)
         uint8_t i, selected_power = PD_protocol_get_selected_power(&protocol);
         PD_protocol_get_power_info(&protocol, selected_power, &p);
         wait_ps_rdy = 0;
+        status_contract = 1;
+#if PD_UFP_PPS
         if (p.type == PD_PDO_TYPE_AUGMENTED_PDO) {
             // PPS mode
             FUSB302_set_vbus_sense(&FUSB302, 0);
@@ -191,29 +292,58 @@ void PD_UFP_c::handle_protocol_event(PD_protocol_event_t events)
                 send_request = 1;
                 status_log_event(STATUS_LOG_POWER_PPS_STARTUP);
             } else {
+                /* Keepalive re-arms from the accepted request */
                 time_PPS_request = clock_ms();
+#if PD_UFP_PPS_STATUS
+                time_PPS_regulate = time_PPS_request;
+#endif
                 status_power_ready(STATUS_POWER_PPS, 
                     PD_protocol_get_PPS_voltage(&protocol), PD_protocol_get_PPS_current(&protocol));
                 status_log_event(STATUS_LOG_POWER_READY);
             }
-        } else {
+        } else
+#endif
+        {
             FUSB302_set_vbus_sense(&FUSB302, 1);
             status_power_ready(STATUS_POWER_TYP, p.max_v, p.max_i);
             status_log_event(STATUS_LOG_POWER_READY);
         }
     }
+#if PD_UFP_PPS_STATUS
+    if (events & PD_PROTOCOL_EVENT_PPS_STATUS) {
+        if (PPS_regulate_voltage && status_power == STATUS_POWER_PPS && !wait_ps_rdy &&
+            PD_protocol_regulate_PPS(&protocol, PPS_regulate_voltage, PPS_regulate_cable_mohm, PD_UFP_PPS_REGULATE_STEP)) {
+            send_request = 1;
+        }
+    }
+#endif
 }
 
 void PD_UFP_c::handle_FUSB302_event(FUSB302_event_t events)
 {
     if (events & FUSB302_EVENT_DETACHED) {
         PD_protocol_reset(&protocol);
+        status_contract = 0;
+        request_retry = 0;
+        tx_busy = 0;
+        /* Nothing is sent until the next attach, timer() must not retry or hard reset */
+        wait_src_cap = 0;
+        get_src_cap_retry_count = 0;
+        wait_ps_rdy = 0;
+        wait_respond = 0;
+        send_request = 0;
+#if PD_UFP_PPS
+        PPS_pending = 0;
+#endif
         return;
     }
     if (events & FUSB302_EVENT_ATTACHED) {
         uint8_t cc1 = 0, cc2 = 0, cc = 0;
         FUSB302_get_cc(&FUSB302, &cc1, &cc2);
         PD_protocol_reset(&protocol);
+        status_contract = 0;
+        request_retry = 0;
+        tx_busy = 0;
         if (cc1 && cc2 == 0) {
             cc = cc1;
         } else if (cc2 && cc1 == 0) {
@@ -231,20 +361,50 @@ void PD_UFP_c::handle_FUSB302_event(FUSB302_event_t events)
         PD_protocol_event_t protocol_event = 0;
         uint16_t header;
         uint32_t obj[7];
-        FUSB302_get_message(&FUSB302, &header, obj);
-        PD_protocol_handle_msg(&protocol, header, obj, &protocol_event);
-        status_log_event(STATUS_LOG_MSG_RX, obj);
-        if (protocol_event) {
-            handle_protocol_event(protocol_event);
+        while (FUSB302_get_message(&FUSB302, &header, obj) == FUSB302_SUCCESS) {
+            PD_protocol_handle_msg(&protocol, header, obj, &protocol_event);
+            status_log_event(STATUS_LOG_MSG_RX, obj);
+            if (protocol_event) {
+                handle_protocol_event(protocol_event);
+                protocol_event = 0;
+            }
+        }
+    }
+    if (events & (FUSB302_EVENT_HARD_RESET_SENT | FUSB302_EVENT_HARD_RESET_RECEIVED)) {
+        PD_protocol_reset(&protocol);
+        status_contract = 0;
+        request_retry = 0;
+        tx_busy = 0;
+    }
+    if (events & FUSB302_EVENT_HARD_RESET_RECEIVED) {
+        /* The source returns to vSafe5V and starts over with Source_Capabilities */
+        wait_respond = 0;
+        wait_ps_rdy = 0;
+        send_request = 0;
+    }
+    if (events & (FUSB302_EVENT_TX_SUCCESS | FUSB302_EVENT_TX_FAILED)) {
+        tx_busy = 0;
+    }
+    if (events & FUSB302_EVENT_TX_FAILED) {
+        status_log_event(STATUS_LOG_MSG_TX_FAILED);
+        if (wait_ps_rdy && PD_protocol_is_request(tx_header)) {
+            /* Request not received by the source, no need to wait for t_RequestToPSReady */
+            wait_ps_rdy = 0;
+            if (status_contract) {
+                /* The contract stays, send the request again, e.g. a PPS keepalive */
+                send_request = 1;
+                request_retry = 1;
+                time_request_retry = clock_ms();
+            } else {
+                set_default_power();
+            }
         }
     }
     if (events & FUSB302_EVENT_GOOD_CRC_SENT) {
-        uint16_t header;
-        uint32_t obj[7];
-        delay_ms(2);  /* Delay respond in case there are retry messages */
-        if (PD_protocol_respond(&protocol, &header, obj)) {
-            status_log_event(STATUS_LOG_MSG_TX, obj);
-            FUSB302_tx_sop(&FUSB302, header, obj);
+        /* Respond from timer() after t_ResponseDelay, retransmitted messages are dropped by MessageID */
+        if (PD_protocol_respond_pending(&protocol)) {
+            wait_respond = 1;
+            time_respond = clock_ms();
         }
     }
 }
@@ -252,46 +412,95 @@ void PD_UFP_c::handle_FUSB302_event(FUSB302_event_t events)
 bool PD_UFP_c::timer(void)
 {
     uint16_t t = clock_ms();
-    if (wait_src_cap && (uint16_t)(t - time_wait_src_cap) > t_TypeCSinkWaitCap) {
+    /* One message per pass, the next one is sent after TX_SUCCESS or TX_FAILED of the last one */
+    if (wait_respond && !tx_busy && (uint16_t)(t - time_respond) >= t_ResponseDelay) {
+        uint16_t header;
+        uint32_t obj[7];
+        wait_respond = 0;
+        if (PD_protocol_respond(&protocol, &header, obj)) {
+            tx_sop(header, obj);
+        }
+    }
+    if (wait_src_cap && !tx_busy && (uint16_t)(t - time_wait_src_cap) > t_TypeCSinkWaitCap) {
         time_wait_src_cap = t;
         if (get_src_cap_retry_count < 3) {
             uint16_t header;
             get_src_cap_retry_count += 1;
             /* Try to request soruce capabilities message (will not cause power cycle VBUS) */
             PD_protocol_create_get_src_cap(&protocol, &header);
-            status_log_event(STATUS_LOG_MSG_TX);
-            FUSB302_tx_sop(&FUSB302, header, 0);
+            tx_sop(header, 0);
         } else {
             get_src_cap_retry_count = 0;
             /* Hard reset will cause the source power cycle VBUS. */
             FUSB302_tx_hard_reset(&FUSB302);
-            PD_protocol_reset(&protocol);
         }
     }
+#if PD_UFP_PPS
+    if (PPS_pending && !wait_ps_rdy) {
+        /* Coalesced setpoint, no request if it ends where the last request was */
+        PPS_pending = 0;
+        if (status_power == STATUS_POWER_PPS &&
+            PD_protocol_set_PPS(&protocol, PPS_voltage_pending, PPS_current_pending, true)) {
+            send_request = 1;
+        }
+    }
+#endif
+    if (request_retry && (uint16_t)(t - time_request_retry) > t_PD_POLLING) {
+        request_retry = 0;
+    }
     if (wait_ps_rdy) {
         if ((uint16_t)(t - time_wait_ps_rdy) > t_RequestToPSReady) {
             wait_ps_rdy = 0;
             set_default_power();
         }
-    } else if (send_request || (status_power == STATUS_POWER_PPS && (uint16_t)(t - time_PPS_request) > t_PPSRequest)) {
+    } else if (!tx_busy && !request_retry && (send_request || PPS_keepalive_due(t))) {
         wait_ps_rdy = 1;
         send_request = 0;
-        time_PPS_request = t;
         uint16_t header;
         uint32_t obj[7];
         /* Send request if option updated or regularly in PPS mode to keep power alive */
         PD_protocol_create_request(&protocol, &header, obj);
-        status_log_event(STATUS_LOG_MSG_TX, obj);
         time_wait_ps_rdy = clock_ms();
-        FUSB302_tx_sop(&FUSB302, header, obj);
+#if PD_UFP_PPS
+        /* Re-armed again on PS_RDY, a Reject or Wait keeps the keepalive period */
+        time_PPS_request = time_wait_ps_rdy;
+#endif
+        tx_sop(header, obj);
+    }
+#if PD_UFP_PPS_STATUS
+    else if (!tx_busy && PPS_regulate_voltage && status_power == STATUS_POWER_PPS && (uint16_t)(t - time_PPS_regulate) > t_PPSRegulate) {
+        uint16_t header;
+        time_PPS_regulate = t;
+        /* Closed-loop PPS, the PPS_Status answer is handled in handle_protocol_event() */
+        PD_protocol_create_get_PPS_status(&protocol, &header);
+        tx_sop(header, 0);
     }
-    if ((uint16_t)(t - time_polling) > t_PD_POLLING) {
+#endif
+    /* Poll only while attached, attach is signalled on INT */
+    if (FUSB302_is_attached(&FUSB302) && (uint16_t)(t - time_polling) > t_PD_POLLING) {
         time_polling = t;
         return true;
     }
     return false;
 }
 
+bool PD_UFP_c::PPS_keepalive_due(uint16_t t)
+{
+#if PD_UFP_PPS
+    return status_power == STATUS_POWER_PPS && (uint16_t)(t - time_PPS_request) > t_PPSRequest;
+#else
+    return false;
+#endif
+}
+
+void PD_UFP_c::tx_sop(uint16_t header, uint32_t * obj)
+{
+    tx_header = header;
+    status_log_event(STATUS_LOG_MSG_TX, obj);
+    /* TX_SUCCESS and TX_FAILED are only reported while attached */
+    tx_busy = FUSB302_tx_sop(&FUSB302, header, obj) == FUSB302_SUCCESS && FUSB302_is_attached(&FUSB302);
+}
+
 void PD_UFP_c::set_default_power(void)
 {
     status_power_ready(STATUS_POWER_TYP, PD_V(5), PD_A(1));
@@ -307,12 +516,18 @@ void PD_UFP_c::status_power_ready(status_power_t status, uint16_t voltage, uint1
 
 uint8_t PD_UFP_c::clock_prescaler = 1;
 
+#if defined(ARDUINO)
+const PD_UFP_HAL_t * PD_UFP_c::hal = &PD_UFP_HAL_arduino;
+#else
+const PD_UFP_HAL_t * PD_UFP_c::hal = 0;
+#endif
+
 void PD_UFP_c::delay_ms(uint16_t ms)
 {
-    delay(ms / clock_prescaler);
+    hal->delay_ms(ms / clock_prescaler);
 }
 
 uint16_t PD_UFP_c::clock_ms(void)
 {
-    return (uint16_t)millis() * clock_prescaler;
+    return (uint16_t)hal->clock_ms() * clock_prescaler;
 }
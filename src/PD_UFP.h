@@ -7,7 +7,8 @@
  *
  * Minimalist USB PD Ardunio Library for PD Micro board
  * Only support UFP(device) sink only functionality
- * Requires FUSB302_UFP.h, PD_UFP_Protocol.h and Standard Arduino Library
+ * Requires FUSB302_UFP.h, PD_UFP_Protocol.h and Standard Arduino Library,
+ * or a PD_UFP_HAL_t for other platforms, see PD_UFP_HAL.h
  *
  * Support PD3.0 PPS
  * 
@@ -18,12 +19,17 @@
 
 #include <stdint.h>
 
+#if defined(ARDUINO)
 #include <Arduino.h>
 #include <Wire.h>
 #include <HardwareSerial.h>
+#endif
 
+#include "PD_UFP_Config.h"
 #include "FUSB302_UFP.h"
+#include "PD_UFP_HAL.h"
 #include "PD_UFP_Protocol.h"
+#include "PD_UFP_Ring.h"
 
 enum {
     STATUS_POWER_NA = 0,
@@ -32,6 +38,22 @@ enum {
 };
 typedef uint8_t status_power_t;
 
+/* Status log events, also the status code of binary log records */
+enum {
+    STATUS_LOG_MSG_TX,
+    STATUS_LOG_MSG_RX,
+    STATUS_LOG_DEV,
+    STATUS_LOG_CC,
+    STATUS_LOG_SRC_CAP,
+    STATUS_LOG_POWER_READY,
+    STATUS_LOG_POWER_PPS_STARTUP,
+    STATUS_LOG_POWER_REJECT,
+    STATUS_LOG_LOAD_SW_ON,
+    STATUS_LOG_LOAD_SW_OFF,
+    STATUS_LOG_MSG_TX_FAILED,
+    STATUS_LOG_OVERFLOW,
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // PD_UFP_c
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -41,9 +63,18 @@ class PD_UFP_c
         PD_UFP_c();
         // Init
         void init(uint8_t int_pin, enum PD_power_option_t power_option = PD_POWER_OPTION_MAX_5V);
+#if PD_UFP_PPS
         void init_PPS(uint8_t int_pin, uint16_t PPS_voltage, uint8_t PPS_current, enum PD_power_option_t power_option = PD_POWER_OPTION_MAX_5V);
-        // Task
-        void run(void);
+#endif
+        // I2C bus and address of the FUSB302, call before init. Default Wire and 0x22
+#if defined(ARDUINO)
+        void set_i2c(TwoWire & wire, uint8_t address = 0x22) { set_i2c((void *)&wire, address); }
+#endif
+        // Bus as the context of the HAL i2c callbacks
+        void set_i2c(void * context, uint8_t address = 0x22);
+        // Task, returns ms until the next timed event. Call again after that time or when int pin goes low
+        uint16_t run(void);
+        uint16_t next_wakeup_ms(void);
         // Status
         bool is_power_ready(void) { return status_power == STATUS_POWER_TYP; }
         bool is_PPS_ready(void)   { return status_power == STATUS_POWER_PPS; }
@@ -53,19 +84,34 @@ class PD_UFP_c
         uint16_t get_current(void) { return ready_current; }    // Current in 10mA units, 50mA(PPS)
         status_power_t get_ps_status(void) { return status_power; }
         // Set
+#if PD_UFP_PPS
+        // Setpoints set while a request is in flight are coalesced, the latest is sent after PS_RDY
         bool set_PPS(uint16_t PPS_voltage, uint8_t PPS_current);
+#endif
+#if PD_UFP_PPS_STATUS
+        // Closed-loop PPS: hold voltage (20mV units) at the load from the PPS_Status of the source, 0 to stop.
+        // cable_mohm is the resistance of cable and connectors, VBUS and GND path
+        void set_PPS_regulation(uint16_t voltage, uint16_t cable_mohm);
+#endif
         void set_power_option(enum PD_power_option_t power_option);
+        // Select Fixed, Variable or Battery power by requirements, see PD_power_policy_t
+        void set_power_policy(const PD_power_policy_t & policy);
+        // Keep the FUSB302 at minimum power while detached, woken by a partner on CC. Call after init
+        void set_low_power_idle(bool enable);
         // Clock
         static void clock_prescale_set(uint8_t prescaler);
+        // Platform of all ports, call before init. Default PD_UFP_HAL_arduino on Arduino
+        static void set_hal(const PD_UFP_HAL_t & hal);
 
     protected:
-        static FUSB302_ret_t FUSB302_i2c_read(uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
-        static FUSB302_ret_t FUSB302_i2c_write(uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
         static FUSB302_ret_t FUSB302_delay_ms(uint32_t t);
+        static uint32_t FUSB302_clock_us(void);
         void handle_protocol_event(PD_protocol_event_t events);
         void handle_FUSB302_event(FUSB302_event_t events);
         bool timer(void);
+        bool PPS_keepalive_due(uint16_t t);
         void set_default_power(void);
+        void tx_sop(uint16_t header, uint32_t * obj);
         // Device
         FUSB302_dev_t FUSB302;
         PD_protocol_t protocol;
@@ -73,40 +119,92 @@ class PD_UFP_c
         // Power ready power
         uint16_t ready_voltage;
         uint16_t ready_current;
+#if PD_UFP_PPS
         // PPS setup
         uint16_t PPS_voltage_next;
         uint8_t PPS_current_next;
+        // PPS setpoint set while a request is in flight, only the latest is sent
+        uint16_t PPS_voltage_pending;
+        uint8_t PPS_current_pending;
+        uint8_t PPS_pending;
+#endif
+#if PD_UFP_PPS_STATUS
+        // Closed-loop PPS
+        uint16_t PPS_regulate_voltage;
+        uint16_t PPS_regulate_cable_mohm;
+#endif
         // Status
         virtual void status_power_ready(status_power_t status, uint16_t voltage, uint16_t current);
         uint8_t status_initialized;
         uint8_t status_src_cap_received;
+        uint8_t status_contract;        // Explicit contract, PS_RDY received
         status_power_t status_power;
         // Timer and counter for PD Policy
         uint16_t time_polling;
         uint16_t time_wait_src_cap;
         uint16_t time_wait_ps_rdy;
+#if PD_UFP_PPS
         uint16_t time_PPS_request;
+#endif
+#if PD_UFP_PPS_STATUS
+        uint16_t time_PPS_regulate;
+#endif
+        uint16_t time_respond;
+        uint16_t time_request_retry;
+        uint16_t tx_header;             // Last message sent
         uint8_t get_src_cap_retry_count;
         uint8_t wait_src_cap;
         uint8_t wait_ps_rdy;
+        uint8_t wait_respond;
         uint8_t send_request;
+        uint8_t request_retry;          // Request failed, send again after t_PD_POLLING
+        uint8_t tx_busy;                // Message sent, waiting for TX_SUCCESS or TX_FAILED
         static uint8_t clock_prescaler;
+        static const PD_UFP_HAL_t * hal;
         // Time functions        
         void delay_ms(uint16_t ms);
         uint16_t clock_ms(void);
         // Status logging
+#if PD_UFP_LOG
         virtual void status_log_event(uint8_t status, uint32_t * obj = 0) {}
+#else
+        void status_log_event(uint8_t status, uint32_t * obj = 0) {}
+#endif
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Optional: PD_UFP_Ports_c, runs several PD_UFP_c ports from one loop, e.g. multi-port chargers.
+//           Each port needs its own int pin and its own bus or I2C address, see set_i2c().
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class PD_UFP_Ports_c
+{
+    public:
+        PD_UFP_Ports_c();
+        bool add(PD_UFP_c & port);
+        // Task, run every port once. The first port served rotates, so no port is always last
+        // Returns ms until the next timed event of any port
+        uint16_t run(void);
+        // Get
+        uint8_t get_count(void) { return count; }
+        PD_UFP_c * get_port(uint8_t index) { return index < count ? port[index] : 0; }
+
+    protected:
+        PD_UFP_c * port[PD_UFP_MAX_PORTS];
+        uint8_t count;
+        uint8_t next;
 };
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Optional: PD_UFP_Log_c, extended from PD_UFP_c to provide logging function.
-//           Asynchronous, minimal impact on PD timing.
+//           Asynchronous, minimal impact on PD timing. Requires PD_UFP_LOG
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+#if PD_UFP_LOG
 struct status_log_t {
     uint16_t time;
-    uint16_t msg_header;
-    uint8_t obj_count;
+    uint16_t msg_header;    /* STATUS_LOG_OVERFLOW: events dropped before this one */
+    uint8_t obj_count;      /* STATUS_LOG_OVERFLOW: data objects dropped, max 255 */
     uint8_t status;
 };
 
@@ -115,35 +213,57 @@ enum pd_log_level_t {
     PD_LOG_LEVEL_VERBOSE
 };
 
+/* Binary log record: sync, payload length, payload, CRC-8 (poly 0x07) of length and payload.
+   Payload: time delta to the previous record in ms (LEB128, 1 ... 3 bytes), status (STATUS_LOG_*), then
+     MSG_TX, MSG_RX     message header, data objects
+     DEV                initialized, version ID, revision ID
+     CC                 cc1, cc2
+     SRC_CAP            selected position, PDO count, per PDO type << 30 | max_v << 20 | min_v << 10 | max_i
+                        as in PD_power_cache_t, max_p for battery supply
+     POWER_READY        status_power, voltage, current
+     OVERFLOW           events dropped (u16), data objects dropped (u8)
+   Multi-byte fields are little endian. extras/host/PD_UFP_log_decode prints the text log from records */
+#define PD_UFP_LOG_RECORD_SYNC  0xA5
+#define PD_UFP_LOG_RECORD_MAX   40
+
 class PD_UFP_Log_c : public PD_UFP_c
 {
     public:
         PD_UFP_Log_c(pd_log_level_t log_level = PD_LOG_LEVEL_INFO);
         // Task
+#if defined(ARDUINO)
         //void print_status(Serial_ & serial);
         void print_status(HardwareSerial & serial);
+        // Binary log, whole records only, see PD_UFP_LOG_RECORD_SYNC. Use either print_status or print_status_binary
+        void print_status_binary(HardwareSerial & serial);
+#endif
         // Get
         int status_log_readline(char * buffer, int maxlen);
+        // One binary log record, returns its length, 0 if the log is empty or maxlen < PD_UFP_LOG_RECORD_MAX
+        int status_log_read_record(uint8_t * buffer, int maxlen);
+        // Events and data objects dropped on a full log since start, wrap at 2^16
+        uint16_t get_log_dropped_events(void) { return status_log.get_dropped(); }
+        uint16_t get_log_dropped_objects(void) { return status_log_obj.get_dropped(); }
 
     protected:
         int status_log_readline_msg(char * buffer, int maxlen, status_log_t * log);
         int status_log_readline_src_cap(char * buffer, int maxlen);
-        // Status log functions
-        uint8_t status_log_obj_add(uint16_t header, uint32_t * obj);
+        static uint8_t status_log_record_crc(const uint8_t * data, uint8_t count);
+        // Status log functions, the producer. Safe in an interrupt, from a single context
         virtual void status_log_event(uint8_t status, uint32_t * obj);
-        // status log event queue
-        status_log_t status_log[16];    // array size must be power of 2 and <=256
-        uint8_t status_log_read;
-        uint8_t status_log_write;
-        // status log object queue
-        uint32_t status_log_obj[16];    // array size must be power of 2 and <=256
-        uint8_t status_log_obj_read;
-        uint8_t status_log_obj_write;
-        // state variables
+        // status log event and object queues, lock-free
+        PD_UFP_ring_c<status_log_t, PD_UFP_LOG_SIZE> status_log;
+        PD_UFP_ring_c<uint32_t, PD_UFP_LOG_OBJ_SIZE> status_log_obj;
+        // drops not yet logged by a STATUS_LOG_OVERFLOW event, producer only
+        uint16_t status_log_overflow_events;
+        uint8_t status_log_overflow_objs;
+        // state variables, consumer only
         pd_log_level_t status_log_level;
         uint8_t status_log_counter;        
         char status_log_time[8];
+        uint16_t status_log_record_time;
 };
+#endif
 
 #endif
 
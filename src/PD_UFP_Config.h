@@ -0,0 +1,110 @@
+
+/**
+ * PD_UFP_Config.h
+ *
+ * Compile time configuration of PD_UFP_c and the PD protocol engine
+ * Edit the defaults below, or define the options for the whole build (e.g. -DPD_UFP_PPS=0).
+ * Features turned off are removed together with their state fields and message handlers.
+ *
+ * Features, 1 = enabled, 0 = removed
+ *   PD_UFP_PPS             PD3.0 PPS: set_PPS(), init_PPS(), PPS request and keepalive
+ *   PD_UFP_EXT_MSG         Extended messages: Sink_Capabilities_Extended, PPS_Status.
+ *                          With PD_UFP_PPS also closed-loop PPS, set_PPS_regulation()
+ *                          Without it every extended message is answered with Not_Supported
+ *   PD_UFP_MSG_NAMES       Message names in PD_protocol_get_msg_name(), needed for readable logs
+ *   PD_UFP_LOG             PD_UFP_Log_c and the status_log_event() hook in PD_UFP_c
+ *
+ * Presets
+ *   PD_UFP_TRIGGER_ONLY    Fixed supply trigger, defaults all features above to 0
+ *
+ * Sizes and timing
+ *   PD_UFP_LOG_SIZE        Status log entries, power of 2 and <= 128
+ *   PD_UFP_LOG_OBJ_SIZE    Status log data objects, power of 2 and <= 128
+ *   PD_UFP_MAX_PORTS       Ports in PD_UFP_Ports_c
+ *   PD_UFP_T_*             PD policy timers in ms, see below
+ *   PD_UFP_PPS_REGULATE_STEP   Largest PPS voltage step of set_PPS_regulation(), in 20mV units
+ *   PD_UFP_PPS_KEEPALIVE_MARGIN    PPS keepalive margin in ms under tPPSRequest (10s), sets PD_UFP_T_PPS_REQUEST
+ *
+ * Options of the FUSB302 driver (FUSB302_RX_QUEUE_SIZE, FUSB302_T_CC_DEBOUNCE, FUSB302_T_WAKE_VBUS)
+ * live in FUSB302_UFP.h / FUSB302_UFP.cpp, which do not include this file. Define them for the
+ * whole build, e.g. -DFUSB302_RX_QUEUE_SIZE=2 for a trigger only build.
+ *
+ */
+
+#ifndef PD_UFP_CONFIG_H
+#define PD_UFP_CONFIG_H
+
+#if defined(PD_UFP_TRIGGER_ONLY)
+#define PD_UFP_FEATURE_DEFAULT  0
+#else
+#define PD_UFP_FEATURE_DEFAULT  1
+#endif
+
+#ifndef PD_UFP_PPS
+#define PD_UFP_PPS              PD_UFP_FEATURE_DEFAULT
+#endif
+
+#ifndef PD_UFP_EXT_MSG
+#define PD_UFP_EXT_MSG          PD_UFP_FEATURE_DEFAULT
+#endif
+
+#ifndef PD_UFP_LOG
+#define PD_UFP_LOG              PD_UFP_FEATURE_DEFAULT
+#endif
+
+#ifndef PD_UFP_MSG_NAMES
+#define PD_UFP_MSG_NAMES        PD_UFP_LOG
+#endif
+
+/* PPS_Status is an extended message */
+#define PD_UFP_PPS_STATUS       (PD_UFP_PPS && PD_UFP_EXT_MSG)
+
+#ifndef PD_UFP_LOG_SIZE
+#define PD_UFP_LOG_SIZE         16
+#endif
+
+#ifndef PD_UFP_LOG_OBJ_SIZE
+#define PD_UFP_LOG_OBJ_SIZE     16
+#endif
+
+#ifndef PD_UFP_MAX_PORTS
+#define PD_UFP_MAX_PORTS        4
+#endif
+
+#ifndef PD_UFP_T_POLLING
+#define PD_UFP_T_POLLING        100     /* status poll while attached */
+#endif
+
+#ifndef PD_UFP_T_SINK_WAIT_CAP
+#define PD_UFP_T_SINK_WAIT_CAP  350     /* tTypeCSinkWaitCap */
+#endif
+
+#ifndef PD_UFP_T_REQUEST_TO_PS_READY
+#define PD_UFP_T_REQUEST_TO_PS_READY    580     /* combine tSenderResponse and tPSTransition */
+#endif
+
+#ifndef PD_UFP_PPS_KEEPALIVE_MARGIN
+#define PD_UFP_PPS_KEEPALIVE_MARGIN 2000    /* PPS keepalive margin under tPPSRequest (10s) */
+#endif
+
+#ifndef PD_UFP_T_PPS_REQUEST
+#define PD_UFP_T_PPS_REQUEST    (10000 - PD_UFP_PPS_KEEPALIVE_MARGIN)   /* PPS keepalive, from the last accepted request */
+#endif
+
+#if PD_UFP_PPS && PD_UFP_T_PPS_REQUEST + PD_UFP_T_REQUEST_TO_PS_READY >= 10000
+#error "PD_UFP_T_PPS_REQUEST leaves no margin for the keepalive request under tPPSRequest (10s)"
+#endif
+
+#ifndef PD_UFP_T_PPS_REGULATE
+#define PD_UFP_T_PPS_REGULATE   250     /* PPS_Status poll of closed-loop PPS, covers tPpsSrcTransSmall (25ms) */
+#endif
+
+#ifndef PD_UFP_PPS_REGULATE_STEP
+#define PD_UFP_PPS_REGULATE_STEP    25  /* Max closed-loop PPS step in 20mV units, vPpsSmallStep (500mV) */
+#endif
+
+#ifndef PD_UFP_T_RESPONSE_DELAY
+#define PD_UFP_T_RESPONSE_DELAY 2       /* must less than tSenderResponse (24ms) */
+#endif
+
+#endif
@@ -0,0 +1,36 @@
+/**
+ * PD_UFP_HAL.h
+ *
+ * Platform interface of PD_UFP_c: FUSB302 int pin, monotonic time, delay and I2C
+ * One HAL serves every port of a program, each port has its own int pin and I2C context (set_i2c).
+ * Arduino builds default to PD_UFP_HAL_arduino (TwoWire, millis / micros, digitalRead).
+ * Other platforms provide their own and pass it to PD_UFP_c::set_hal() before init,
+ * e.g. extras/host/PD_UFP_HAL_host.h for Linux builds on FUSB302_sim in virtual time.
+ *
+ */
+
+#ifndef PD_UFP_HAL_H
+#define PD_UFP_HAL_H
+
+#include <stdint.h>
+
+#include "FUSB302_UFP.h"
+
+typedef struct {
+    /* I2C to the FUSB302, context is the bus set by PD_UFP_c::set_i2c() */
+    FUSB302_ret_t (*i2c_read)(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
+    FUSB302_ret_t (*i2c_write)(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count);
+    /* FUSB302 int pin, input with pull up. pin_read returns 0 while the FUSB302 asserts int */
+    void (*pin_init)(uint8_t pin);
+    uint8_t (*pin_read)(uint8_t pin);
+    /* Monotonic time in ms and us, each wraps at 2^32 */
+    uint32_t (*clock_ms)(void);
+    uint32_t (*clock_us)(void);
+    void (*delay_ms)(uint32_t ms);
+} PD_UFP_HAL_t;
+
+#if defined(ARDUINO)
+extern const PD_UFP_HAL_t PD_UFP_HAL_arduino;
+#endif
+
+#endif /* PD_UFP_HAL_H */
@@ -0,0 +1,80 @@
+/**
+ * PD_UFP_HAL_Arduino.cpp
+ *
+ * PD_UFP_HAL_t on the Arduino core: TwoWire, digitalRead, millis / micros and delay
+ * The I2C context is the TwoWire passed to PD_UFP_c::set_i2c(), Wire by default.
+ *
+ */
+
+#if defined(ARDUINO)
+
+#include <stdint.h>
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#include "PD_UFP_HAL.h"
+
+static FUSB302_ret_t arduino_i2c_read(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count)
+{
+    TwoWire & wire = *(TwoWire *)context;
+    wire.beginTransmission(dev_addr);
+    wire.write(reg_addr);
+    wire.endTransmission();
+    wire.requestFrom(dev_addr, count);
+    while (wire.available() && count > 0) {
+        *data++ = wire.read();
+        count--;
+    }
+    return count == 0 ? FUSB302_SUCCESS : FUSB302_ERR_READ_DEVICE;
+}
+
+static FUSB302_ret_t arduino_i2c_write(void *context, uint8_t dev_addr, uint8_t reg_addr, uint8_t *data, uint8_t count)
+{
+    TwoWire & wire = *(TwoWire *)context;
+    wire.beginTransmission(dev_addr);
+    wire.write(reg_addr);
+    while (count > 0) {
+        wire.write(*data++);
+        count--;
+    }
+    wire.endTransmission();
+    return FUSB302_SUCCESS;
+}
+
+static void arduino_pin_init(uint8_t pin)
+{
+    pinMode(pin, INPUT_PULLUP);
+}
+
+static uint8_t arduino_pin_read(uint8_t pin)
+{
+    return digitalRead(pin) ? 1 : 0;
+}
+
+static uint32_t arduino_clock_ms(void)
+{
+    return millis();
+}
+
+static uint32_t arduino_clock_us(void)
+{
+    return micros();
+}
+
+static void arduino_delay_ms(uint32_t ms)
+{
+    delay(ms);
+}
+
+const PD_UFP_HAL_t PD_UFP_HAL_arduino = {
+    arduino_i2c_read,
+    arduino_i2c_write,
+    arduino_pin_init,
+    arduino_pin_read,
+    arduino_clock_ms,
+    arduino_clock_us,
+    arduino_delay_ms,
+};
+
+#endif
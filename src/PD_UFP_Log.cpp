@@ -18,73 +18,81 @@
 
 #include "PD_UFP.h"
 
-enum {
-    STATUS_LOG_MSG_TX,
-    STATUS_LOG_MSG_RX,
-    STATUS_LOG_DEV,
-    STATUS_LOG_CC,
-    STATUS_LOG_SRC_CAP,
-    STATUS_LOG_POWER_READY,
-    STATUS_LOG_POWER_PPS_STARTUP,
-    STATUS_LOG_POWER_REJECT,
-    STATUS_LOG_LOAD_SW_ON,
-    STATUS_LOG_LOAD_SW_OFF,
-};
+#if PD_UFP_LOG
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Optional: PD_UFP_Log_c, extended from PD_UFP_c to provide logging function.
 //           Asynchronous, minimal impact on PD timing.
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-#define STATUS_LOG_MASK         (sizeof(status_log) / sizeof(status_log[0]) - 1)
-#define STATUS_LOG_OBJ_MASK     (sizeof(status_log_obj) / sizeof(status_log_obj[0]) - 1)
-
 PD_UFP_Log_c::PD_UFP_Log_c(pd_log_level_t log_level):
-    status_log_write(0),
-    status_log_read(0),
+    status_log_overflow_events(0),
+    status_log_overflow_objs(0),
+    status_log_level(log_level),
     status_log_counter(0),
-    status_log_obj_read(0),
-    status_log_obj_write(0),
-    status_log_level(log_level)
+    status_log_record_time(0)
 {
-
+    status_log_time[0] = 0;
 }
 
-uint8_t PD_UFP_Log_c::status_log_obj_add(uint16_t header, uint32_t * obj)
+static uint8_t add_saturate(uint8_t a, uint8_t b)
 {
-    if (obj) {
-        uint8_t i, w = status_log_obj_write, r = status_log_obj_read;
-        PD_msg_info_t info;
-        PD_protocol_get_msg_info(header, &info);
-        for (i = 0; i < info.num_of_obj && (uint8_t)(w - r) < STATUS_LOG_OBJ_MASK; i++) {
-            status_log_obj[w++ & STATUS_LOG_OBJ_MASK] = obj[i];
-        }
-        status_log_obj_write = w;
-        return i;
-    }
-    return 0;
+    return b > 0xFF - a ? 0xFF : a + b;
 }
 
+// Producer of the status log, see PD_UFP_ring_c
 void PD_UFP_Log_c::status_log_event(uint8_t status, uint32_t * obj)
 {
-    if (((status_log_write - status_log_read) & STATUS_LOG_MASK) >= STATUS_LOG_MASK) {
+    uint16_t header = 0;
+    uint8_t num_of_obj = 0;
+    if (status == STATUS_LOG_MSG_TX || status == STATUS_LOG_MSG_RX) {
+        header = status == STATUS_LOG_MSG_TX ? PD_protocol_get_tx_msg_header(&protocol) :
+            PD_protocol_get_rx_msg_header(&protocol);
+        if (obj) {
+            PD_msg_info_t info;
+            PD_protocol_get_msg_info(header, &info);
+            num_of_obj = info.num_of_obj;
+        }
+    }
+    // Pending drops need one more entry for the overflow event
+    uint8_t overflow = status_log_overflow_events || status_log_overflow_objs;
+    if (status_log.space() < 1 + overflow) {
+        status_log.drop(1);
+        status_log_obj.drop(num_of_obj);
+        if (status_log_overflow_events < 0xFFFF) {
+            status_log_overflow_events++;
+        }
+        status_log_overflow_objs = add_saturate(status_log_overflow_objs, num_of_obj);
         return;
     }
-    status_log_t * log = &status_log[status_log_write & STATUS_LOG_MASK];
-    switch (status) {
-    case STATUS_LOG_MSG_TX:
-        log->msg_header = PD_protocol_get_tx_msg_header(&protocol);
-        log->obj_count = status_log_obj_add(log->msg_header, obj);
-        break;
-    case STATUS_LOG_MSG_RX:
-        log->msg_header = PD_protocol_get_rx_msg_header(&protocol);
-        log->obj_count = status_log_obj_add(log->msg_header, obj);
-        break;
-    default:
-        break;
+    uint16_t time = clock_ms();
+    status_log_t * log;
+    if (overflow) {
+        log = status_log.back();
+        log->time = time;
+        log->msg_header = status_log_overflow_events;
+        log->obj_count = status_log_overflow_objs;
+        log->status = STATUS_LOG_OVERFLOW;
+        status_log.push();
+        status_log_overflow_events = 0;
+        status_log_overflow_objs = 0;
     }
+    // Objects are published before their event, the consumer reads them after the event
+    uint8_t space = status_log_obj.space();
+    uint8_t count = num_of_obj < space ? num_of_obj : space;
+    for (uint8_t i = 0; i < count; i++) {
+        *status_log_obj.back() = obj[i];
+        status_log_obj.push();
+    }
+    if (count < num_of_obj) {
+        status_log_obj.drop(num_of_obj - count);
+        status_log_overflow_objs = add_saturate(status_log_overflow_objs, num_of_obj - count);
+    }
+    log = status_log.back();
+    log->time = time;
+    log->msg_header = header;
+    log->obj_count = count;
     log->status = status;
-    log->time = clock_ms();
-    status_log_write++;
+    status_log.push();
 }
 
 // Optimize RAM usage on AVR MCU by allocate format string in program memory
@@ -92,6 +100,7 @@ void PD_UFP_Log_c::status_log_event(uint8_t status, uint32_t * obj)
 #include <avr/pgmspace.h>
 #define SNPRINTF snprintf_P
 #else
+#include <stdio.h>
 #define SNPRINTF snprintf
 #define PSTR(str) str
 #endif
@@ -106,20 +115,26 @@ int PD_UFP_Log_c::status_log_readline_msg(char * buffer, int maxlen, status_log_
         // output message header
         char type = log->status == STATUS_LOG_MSG_TX ? 'T' : 'R';
         PD_msg_info_t info;
+        char name[16];
         PD_protocol_get_msg_info(log->msg_header, &info);
+        PD_protocol_get_msg_name(log->msg_header, name, sizeof(name));
         if (status_log_level >= PD_LOG_LEVEL_VERBOSE) {
             const char * ext = info.extended ? "ext, " : "";
-            LOG("%s%cX %s id=%d %sraw=0x%04X\n", t, type, info.name, info.id, ext, log->msg_header);
-            if (info.num_of_obj) {
+            LOG("%s%cX %s id=%d %sraw=0x%04X\n", t, type, name, info.id, ext, log->msg_header);
+            if (log->obj_count) {
                 status_log_counter++;
             }
         } else {
-            LOG("%s%cX %s\n", t, type, info.name);
+            LOG("%s%cX %s\n", t, type, name);
+            for (uint8_t i = 0; i < log->obj_count; i++) {
+                status_log_obj.pop();
+            }
         }
     } else {
         // output object data
         int i = status_log_counter - 1;
-        uint32_t obj = status_log_obj[status_log_obj_read++ & STATUS_LOG_OBJ_MASK];
+        uint32_t obj = *status_log_obj.front();
+        status_log_obj.pop();
         LOG("%s obj%d=0x%08lX\n", t, i, obj);
         if (++status_log_counter > log->obj_count) {
             status_log_counter = 0;
@@ -155,11 +170,11 @@ int PD_UFP_Log_c::status_log_readline_src_cap(char * buffer, int maxlen)
 
 int PD_UFP_Log_c::status_log_readline(char * buffer, int maxlen)
 {
-    if (status_log_write == status_log_read) {
+    if (status_log.count() == 0) {
         return 0;
     }
     
-    status_log_t * log = &status_log[status_log_read & STATUS_LOG_MASK];
+    status_log_t * log = status_log.front();
     int n = 0;
     char * t = status_log_time;
     if (t[0] == 0) {    // Convert timestamp number to string
@@ -219,15 +234,112 @@ int PD_UFP_Log_c::status_log_readline(char * buffer, int maxlen)
     case STATUS_LOG_LOAD_SW_OFF:
         LOG("%sLoad SW OFF\n", t);
         break;
+    case STATUS_LOG_MSG_TX_FAILED:
+        LOG("%sTX failed, no GoodCRC\n", t);
+        break;
+    case STATUS_LOG_OVERFLOW:
+        LOG("%sLog overflow, %u events %u objects dropped\n", t, log->msg_header, log->obj_count);
+        break;
     }
     if (status_log_counter == 0) {
         t[0] = 0;
-        status_log_read++;
+        status_log.pop();
         status_log_counter = 0;
     }
     return n;
 }
 
+uint8_t PD_UFP_Log_c::status_log_record_crc(const uint8_t * data, uint8_t count)
+{
+    uint8_t crc = 0;
+    while (count--) {
+        crc ^= *data++;
+        for (uint8_t i = 0; i < 8; i++) {
+            crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint8_t * put_u16(uint8_t * p, uint16_t v)
+{
+    *p++ = v & 0xFF;
+    *p++ = v >> 8;
+    return p;
+}
+
+static uint8_t * put_u32(uint8_t * p, uint32_t v)
+{
+    p = put_u16(p, v & 0xFFFF);
+    return put_u16(p, v >> 16);
+}
+
+int PD_UFP_Log_c::status_log_read_record(uint8_t * buffer, int maxlen)
+{
+    if (status_log.count() == 0 || maxlen < PD_UFP_LOG_RECORD_MAX) {
+        return 0;
+    }
+    status_log_t * log = status_log.front();
+    uint8_t * p = buffer + 2;
+    uint16_t dt = log->time - status_log_record_time;
+    status_log_record_time = log->time;
+    do {
+        *p++ = (dt & 0x7F) | (dt > 0x7F ? 0x80 : 0);
+        dt >>= 7;
+    } while (dt);
+    *p++ = log->status;
+    switch (log->status) {
+    case STATUS_LOG_MSG_TX:
+    case STATUS_LOG_MSG_RX:
+        p = put_u16(p, log->msg_header);
+        for (uint8_t i = 0; i < log->obj_count; i++) {
+            p = put_u32(p, *status_log_obj.front());
+            status_log_obj.pop();
+        }
+        break;
+    case STATUS_LOG_DEV: {
+        uint8_t version_ID = 0, revision_ID = 0;
+        FUSB302_get_ID(&FUSB302, &version_ID, &revision_ID);
+        *p++ = status_initialized;
+        *p++ = version_ID;
+        *p++ = revision_ID;
+        break; }
+    case STATUS_LOG_CC:
+        FUSB302_get_cc(&FUSB302, p, p + 1);
+        p += 2;
+        break;
+    case STATUS_LOG_SRC_CAP: {
+        /* Decoded PDOs, 10-bit fields of PD_power_cache_t */
+        uint8_t count = protocol.power_data_obj_count;
+        *p++ = PD_protocol_get_selected_power(&protocol);
+        *p++ = count;
+        for (uint8_t i = 0; i < count; i++) {
+            const PD_power_cache_t * c = &protocol.power_cache[i];
+            uint16_t max = c->type == PD_PDO_TYPE_BATTERY ? c->max_p : c->max_i;
+            p = put_u32(p, ((uint32_t)c->type << 30) | ((uint32_t)c->max_v << 20) | ((uint32_t)c->min_v << 10) | max);
+        }
+        break; }
+    case STATUS_LOG_POWER_READY:
+        *p++ = status_power;
+        p = put_u16(p, ready_voltage);
+        p = put_u16(p, ready_current);
+        break;
+    case STATUS_LOG_OVERFLOW:
+        p = put_u16(p, log->msg_header);
+        *p++ = log->obj_count;
+        break;
+    default:
+        break;
+    }
+    status_log.pop();
+    uint8_t length = p - buffer - 2;
+    buffer[0] = PD_UFP_LOG_RECORD_SYNC;
+    buffer[1] = length;
+    *p++ = status_log_record_crc(buffer + 1, length + 1);
+    return p - buffer;
+}
+
+#if defined(ARDUINO)
 void PD_UFP_Log_c::print_status(HardwareSerial & serial)
 {
     // Wait for enough tx buffer in serial port to avoid blocking
@@ -239,3 +351,17 @@ void PD_UFP_Log_c::print_status(HardwareSerial & serial)
     }
 }
 
+void PD_UFP_Log_c::print_status_binary(HardwareSerial & serial)
+{
+    // Whole records only, wait for enough tx buffer in serial port to avoid blocking
+    if (serial && serial.availableForWrite() >= PD_UFP_LOG_RECORD_MAX) {
+        uint8_t buf[PD_UFP_LOG_RECORD_MAX];
+        int n = status_log_read_record(buf, sizeof(buf));
+        if (n) {
+            serial.write(buf, n);
+        }
+    }
+}
+#endif
+
+#endif
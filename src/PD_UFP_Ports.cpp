@@ -0,0 +1,49 @@
+/**
+ * PD_UFP_Ports.cpp
+ *
+ * Run several PD_UFP_c ports from one loop
+ *
+ */
+
+#include <stdint.h>
+
+#include "PD_UFP.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// PD_UFP_Ports_c
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PD_UFP_Ports_c::PD_UFP_Ports_c():
+    count(0),
+    next(0)
+{
+}
+
+bool PD_UFP_Ports_c::add(PD_UFP_c & p)
+{
+    if (count >= PD_UFP_MAX_PORTS) {
+        return false;
+    }
+    port[count++] = &p;
+    return true;
+}
+
+uint16_t PD_UFP_Ports_c::run(void)
+{
+    uint16_t wakeup = 0xFFFF;
+    if (count == 0) {
+        return wakeup;
+    }
+    for (uint8_t i = 0, n = next; i < count; i++) {
+        uint16_t t = port[n]->run();
+        if (t < wakeup) {
+            wakeup = t;
+        }
+        if (++n >= count) {
+            n = 0;
+        }
+    }
+    if (++next >= count) {
+        next = 0;
+    }
+    return wakeup;
+}
@@ -12,6 +12,7 @@
  *
  * Support PD3.0 PPS
  * Do not support extended message. Not necessary for PD trigger and PPS.
+ * Features are selected at compile time, see PD_UFP_Config.h
  * 
  * Reference: USB_PD_R2_0 V1.3 - 20170112
  *            USB_PD_R3_0 V2.0 20190829 + ECNs 2020-12-10
@@ -24,9 +25,11 @@
 
 #define PD_SPECIFICATION_REVISION           0x2
 
+#define PD_CONTROL_MSG_TYPE_GOOD_CRC        0x1
 #define PD_CONTROL_MSG_TYPE_ACCEPT          0x3
 #define PD_CONTROL_MSG_TYPE_REJECT          0x4
 #define PD_CONTROL_MSG_TYPE_GET_SRC_CAP     0x7
+#define PD_CONTROL_MSG_TYPE_SOFT_RESET      0xD
 #define PD_CONTROL_MSG_TYPE_NOT_SUPPORT     0x10
 #define PD_CONTROL_MSG_TYPE_GET_PPS_STATUS  0x14
 
@@ -43,32 +46,69 @@ typedef struct {
     uint8_t num_of_obj;
 } PD_msg_header_info_t;
 
-typedef struct {
-    uint16_t limit;
-    uint8_t use_voltage;
-    uint8_t use_current;
-} PD_power_option_setting_t;
+typedef struct {        /* Guaranteed operating range of a Fixed, Variable or Battery PDO */
+    uint16_t min_v;     /* Voltage in 50mV units */
+    uint16_t max_v;     /* Voltage in 50mV units */
+    uint16_t i;         /* Current in 10mA units, lowest over the voltage range */
+    uint32_t p;         /* Power in 0.5mW (50mV x 10mA) units, lowest over the voltage range */
+} PD_power_point_t;
+
+typedef void (*PD_msg_handler_t)(PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events);
+typedef bool (*PD_msg_responder_t)(PD_protocol_t * p, uint16_t * header, uint32_t * obj);
 
 struct PD_msg_state_t {
+#if PD_UFP_MSG_NAMES
     const char * name;
-    void (*handler)(PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events);
-    bool (*responder)(PD_protocol_t * p, uint16_t * header, uint32_t * obj);
+#endif
+    PD_msg_handler_t handler;
+    PD_msg_responder_t responder;
 };
 
-/* Optimize RAM usage on AVR MCU by allocate const in PROGMEM */
+/* Optimize RAM usage on AVR MCU by allocate const in PROGMEM.
+   Table entries are read field by field from flash, nothing is staged in RAM */
 #if defined(__AVR__)
 #include <avr/pgmspace.h>
-#define SET_MSG_STAGE(d, s) do { static struct PD_msg_state_t m; memcpy_P(&m, s, sizeof(struct PD_msg_state_t)); d = &m; } while (0)
-#define SET_MSG_NAME(d, s)  do { static char n[16]; strncpy_P(n, s, 15); d = n; } while (0)
+#define MSG_HANDLER(s)      ((PD_msg_handler_t)pgm_read_word(&(s)->handler))
+#define MSG_RESPONDER(s)    ((PD_msg_responder_t)pgm_read_word(&(s)->responder))
+#define MSG_NAME_PTR(s)     ((const char *)pgm_read_word(&(s)->name))
+#define COPY_MSG_NAME(d, s, n)  do { strncpy_P(d, s, n); } while (0)
 #define COPY_PDO(d, s)      do { memcpy_P(&d, &s, 4); } while (0)
+#define COPY_POLICY(d, s)   do { memcpy_P(&d, &s, sizeof(PD_power_policy_t)); } while (0)
 #else
 #define PROGMEM
-#define SET_MSG_STAGE(d, s) do { d = s; } while (0)
-#define SET_MSG_NAME(d, s)  do { d = s; } while (0)
+#define MSG_HANDLER(s)      ((s)->handler)
+#define MSG_RESPONDER(s)    ((s)->responder)
+#define MSG_NAME_PTR(s)     ((s)->name)
+#define COPY_MSG_NAME(d, s, n)  do { strncpy(d, s, n); } while (0)
 #define COPY_PDO(d, s)      do { d = s; } while (0)
+#define COPY_POLICY(d, s)   do { d = s; } while (0)
 #endif
 
+#if PD_UFP_MSG_NAMES
 #define T(name) static const char str_ ## name [] PROGMEM = #name
+#define MSG_NAME(s)     .name = str_ ## s,
+#else
+#define MSG_NAME(s)
+#endif
+
+#if PD_UFP_PPS_STATUS
+#define HANDLER_PPS_STATUS      handler_PPS_Status
+#else
+#define HANDLER_PPS_STATUS      0
+#endif
+
+#if PD_UFP_EXT_MSG
+#define RESPONDER_SINK_CAP_EXT  responder_sink_cap_ext
+#else
+#define RESPONDER_SINK_CAP_EXT  responder_not_support
+#endif
+
+/* PPS setting used when evaluating Source_Capabilities */
+#if PD_UFP_PPS
+#define PPS_SETTING(p)          (p)->PPS_voltage, (p)->PPS_current
+#else
+#define PPS_SETTING(p)          0, 0
+#endif
 
 static void handler_good_crc   (PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events);
 static void handler_goto_min   (PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events);
@@ -79,138 +119,206 @@ static void handler_source_cap (PD_protocol_t * p, uint16_t header, uint32_t * o
 static void handler_BIST       (PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events);
 static void handler_alert      (PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events);
 static void handler_vender_def (PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events);
+#if PD_UFP_PPS_STATUS
 static void handler_PPS_Status (PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events);
+#endif
 
 static bool responder_get_sink_cap  (PD_protocol_t * p, uint16_t * header, uint32_t * obj);
 static bool responder_reject        (PD_protocol_t * p, uint16_t * header, uint32_t * obj);
 static bool responder_soft_reset    (PD_protocol_t * p, uint16_t * header, uint32_t * obj);
 static bool responder_source_cap    (PD_protocol_t * p, uint16_t * header, uint32_t * obj);
 static bool responder_vender_def    (PD_protocol_t * p, uint16_t * header, uint32_t * obj);
+#if PD_UFP_EXT_MSG
 static bool responder_sink_cap_ext  (PD_protocol_t * p, uint16_t * header, uint32_t * obj);
+#endif
 static bool responder_not_support   (PD_protocol_t * p, uint16_t * header, uint32_t * obj);
 
+#if PD_UFP_MSG_NAMES
 T(C0); T(GoodCRC); T(GotoMin); T(Accept); T(Reject); T(Ping); T(PS_RDY); T(Get_Src_Cap);
 T(Get_Sink_Cap); T(DR_Swap); T(PR_Swap); T(VCONN_Swap); T(Wait); T(Soft_Rst); T(Dat_Rst); T(Dat_Rst_Cpt);
 T(NS); T(Get_Src_Ext); T(Get_Stat); T(FR_Swap); T(Get_PPS_Stat); T(Get_CC); T(Get_Sink_Ext); T(C_R);
+#endif
 
 static const struct PD_msg_state_t ctrl_msg_list[] PROGMEM = {
-    {.name = str_C0,            .handler = 0,                   .responder = 0},
-    {.name = str_GoodCRC,       .handler = handler_good_crc,    .responder = 0},
-    {.name = str_GotoMin,       .handler = handler_goto_min,    .responder = 0},
-    {.name = str_Accept,        .handler = handler_accept,      .responder = 0},
-    {.name = str_Reject,        .handler = handler_reject,      .responder = 0},
-    {.name = str_Ping,          .handler = 0,                   .responder = 0},
-    {.name = str_PS_RDY,        .handler = handler_ps_rdy,      .responder = 0},
-    {.name = str_Get_Src_Cap,   .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Get_Sink_Cap,  .handler = 0,                   .responder = responder_get_sink_cap},
-    {.name = str_DR_Swap,       .handler = 0,                   .responder = responder_reject},
-    {.name = str_PR_Swap,       .handler = 0,                   .responder = responder_not_support},
-    {.name = str_VCONN_Swap,    .handler = 0,                   .responder = responder_reject},
-    {.name = str_Wait,          .handler = 0,                   .responder = 0},
-    {.name = str_Soft_Rst,      .handler = 0,                   .responder = responder_soft_reset},
-    {.name = str_Dat_Rst,       .handler = 0,                   .responder = 0},
-    {.name = str_Dat_Rst_Cpt,   .handler = 0,                   .responder = 0},
+    {MSG_NAME(C0)               .handler = 0,                   .responder = 0},
+    {MSG_NAME(GoodCRC)          .handler = handler_good_crc,    .responder = 0},
+    {MSG_NAME(GotoMin)          .handler = handler_goto_min,    .responder = 0},
+    {MSG_NAME(Accept)           .handler = handler_accept,      .responder = 0},
+    {MSG_NAME(Reject)           .handler = handler_reject,      .responder = 0},
+    {MSG_NAME(Ping)             .handler = 0,                   .responder = 0},
+    {MSG_NAME(PS_RDY)           .handler = handler_ps_rdy,      .responder = 0},
+    {MSG_NAME(Get_Src_Cap)      .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Get_Sink_Cap)     .handler = 0,                   .responder = responder_get_sink_cap},
+    {MSG_NAME(DR_Swap)          .handler = 0,                   .responder = responder_reject},
+    {MSG_NAME(PR_Swap)          .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(VCONN_Swap)       .handler = 0,                   .responder = responder_reject},
+    {MSG_NAME(Wait)             .handler = 0,                   .responder = 0},
+    {MSG_NAME(Soft_Rst)         .handler = 0,                   .responder = responder_soft_reset},
+    {MSG_NAME(Dat_Rst)          .handler = 0,                   .responder = 0},
+    {MSG_NAME(Dat_Rst_Cpt)      .handler = 0,                   .responder = 0},
     
-    {.name = str_NS,            .handler = 0,                   .responder = 0},
-    {.name = str_Get_Src_Ext,   .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Get_Stat,      .handler = 0,                   .responder = responder_not_support},
-    {.name = str_FR_Swap,       .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Get_PPS_Stat,  .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Get_CC,        .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Get_Sink_Ext,  .handler = 0,                   .responder = responder_sink_cap_ext},
-    {.name = str_C_R,           .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(NS)               .handler = 0,                   .responder = 0},
+    {MSG_NAME(Get_Src_Ext)      .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Get_Stat)         .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(FR_Swap)          .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Get_PPS_Stat)     .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Get_CC)           .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Get_Sink_Ext)     .handler = 0,                   .responder = RESPONDER_SINK_CAP_EXT},
+    {MSG_NAME(C_R)              .handler = 0,                   .responder = responder_not_support},
 };
 
+#if PD_UFP_MSG_NAMES
 T(D0); T(Src_Cap); T(Request); T(BIST); T(Sink_Cap); T(Bat_Stat); T(Alert); T(Get_CI);
 T(Enter_USB); T(D9); T(D10); T(D11); T(D12); T(D13); T(D14); T(VDM);
 T(D_R); 
+#endif
 
 static const struct PD_msg_state_t data_msg_list[] PROGMEM = {
-    {.name = str_D0,            .handler = 0,                   .responder = 0},
-    {.name = str_Src_Cap,       .handler = handler_source_cap,  .responder = responder_source_cap},
-    {.name = str_Request,       .handler = 0,                   .responder = responder_not_support},
-    {.name = str_BIST,          .handler = handler_BIST,        .responder = 0},
-    {.name = str_Sink_Cap,      .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Bat_Stat,      .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Alert,         .handler = handler_alert,       .responder = 0},
-    {.name = str_Get_CI,        .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Enter_USB,     .handler = 0,                   .responder = 0},
-    {.name = str_D9,            .handler = 0,                   .responder = 0},
-    {.name = str_D10,           .handler = 0,                   .responder = 0},
-    {.name = str_D11,           .handler = 0,                   .responder = 0},
-    {.name = str_D12,           .handler = 0,                   .responder = 0},
-    {.name = str_D13,           .handler = 0,                   .responder = 0},
-    {.name = str_D14,           .handler = 0,                   .responder = 0},
-    {.name = str_VDM,           .handler = handler_vender_def,  .responder = responder_vender_def},
-
-    {.name = str_D_R,           .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(D0)               .handler = 0,                   .responder = 0},
+    {MSG_NAME(Src_Cap)          .handler = handler_source_cap,  .responder = responder_source_cap},
+    {MSG_NAME(Request)          .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(BIST)             .handler = handler_BIST,        .responder = 0},
+    {MSG_NAME(Sink_Cap)         .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Bat_Stat)         .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Alert)            .handler = handler_alert,       .responder = 0},
+    {MSG_NAME(Get_CI)           .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Enter_USB)        .handler = 0,                   .responder = 0},
+    {MSG_NAME(D9)               .handler = 0,                   .responder = 0},
+    {MSG_NAME(D10)              .handler = 0,                   .responder = 0},
+    {MSG_NAME(D11)              .handler = 0,                   .responder = 0},
+    {MSG_NAME(D12)              .handler = 0,                   .responder = 0},
+    {MSG_NAME(D13)              .handler = 0,                   .responder = 0},
+    {MSG_NAME(D14)              .handler = 0,                   .responder = 0},
+    {MSG_NAME(VDM)              .handler = handler_vender_def,  .responder = responder_vender_def},
+
+    {MSG_NAME(D_R)              .handler = 0,                   .responder = responder_not_support},
 };
 
+#if PD_UFP_EXT_MSG
+#if PD_UFP_MSG_NAMES
 T(E0); T(Src_Cap_Ext); T(Status); T(Get_Bat_cap); T(Get_Bat_Stat); T(Bat_Cap); T(Get_Mfg_Info); T(Mfg_Info);
 T(Sec_Request); T(Sec_Response); T(FU_request); T(FU_Response); T(PPS_Stat); T(Country_Info); T(Country_Code); T(Sink_Cap_Ext);
 T(E_R);
+#endif
+
+static const struct PD_msg_state_t ext_msg_list[] PROGMEM = {
+    {MSG_NAME(E0)               .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Src_Cap_Ext)      .handler = 0,                   .responder = 0},
+    {MSG_NAME(Status)           .handler = 0,                   .responder = 0},
+    {MSG_NAME(Get_Bat_cap)      .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Get_Bat_Stat)     .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Bat_Cap)          .handler = 0,                   .responder = 0},
+    {MSG_NAME(Get_Mfg_Info)     .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Mfg_Info)         .handler = 0,                   .responder = 0},
+    {MSG_NAME(Sec_Request)      .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Sec_Response)     .handler = 0,                   .responder = 0},
+    {MSG_NAME(FU_request)       .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(FU_Response)      .handler = 0,                   .responder = 0},
+    {MSG_NAME(PPS_Stat)         .handler = HANDLER_PPS_STATUS,  .responder = 0},
+    {MSG_NAME(Country_Info)     .handler = 0,                   .responder = 0},
+    {MSG_NAME(Country_Code)     .handler = 0,                   .responder = 0},
+    {MSG_NAME(Sink_Cap_Ext)     .handler = 0,                   .responder = responder_not_support},
+
+    {MSG_NAME(E_R)              .handler = 0,                   .responder = responder_not_support},
+};
+#else
+#if PD_UFP_MSG_NAMES
+T(Ext);
+#endif
 
+/* Extended messages are not supported, one entry for all */
 static const struct PD_msg_state_t ext_msg_list[] PROGMEM = {
-    {.name = str_E0,            .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Src_Cap_Ext,   .handler = 0,                   .responder = 0},
-    {.name = str_Status,        .handler = 0,                   .responder = 0},
-    {.name = str_Get_Bat_cap,   .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Get_Bat_Stat,  .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Bat_Cap,       .handler = 0,                   .responder = 0},
-    {.name = str_Get_Mfg_Info,  .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Mfg_Info,      .handler = 0,                   .responder = 0},
-    {.name = str_Sec_Request,   .handler = 0,                   .responder = responder_not_support},
-    {.name = str_Sec_Response,  .handler = 0,                   .responder = 0},
-    {.name = str_FU_request,    .handler = 0,                   .responder = responder_not_support},
-    {.name = str_FU_Response,   .handler = 0,                   .responder = 0},
-    {.name = str_PPS_Stat,      .handler = handler_PPS_Status,  .responder = 0},
-    {.name = str_Country_Info,  .handler = 0,                   .responder = 0},
-    {.name = str_Country_Code,  .handler = 0,                   .responder = 0},
-    {.name = str_Sink_Cap_Ext,  .handler = 0,                   .responder = responder_not_support},
-
-    {.name = str_E_R,           .handler = 0,                   .responder = responder_not_support},
+    {MSG_NAME(Ext)              .handler = 0,                   .responder = responder_not_support},
 };
+#endif
 
-static const PD_power_option_setting_t power_option_setting[8] = {
-    {.limit = 25,   .use_voltage = 1, .use_current = 0},    /* PD_POWER_OPTION_MAX_5V */
-    {.limit = 45,   .use_voltage = 1, .use_current = 0},    /* PD_POWER_OPTION_MAX_9V */
-    {.limit = 60,   .use_voltage = 1, .use_current = 0},    /* PD_POWER_OPTION_MAX_12V */
-    {.limit = 75,   .use_voltage = 1, .use_current = 0},    /* PD_POWER_OPTION_MAX_15V */
-    {.limit = 100,  .use_voltage = 1, .use_current = 0},    /* PD_POWER_OPTION_MAX_20V */
-    {.limit = 100,  .use_voltage = 1, .use_current = 0},    /* PD_POWER_OPTION_MAX_VOLTAGE */
-    {.limit = 125,  .use_voltage = 0, .use_current = 1},    /* PD_POWER_OPTION_MAX_CURRENT */
-    {.limit = 12500,.use_voltage = 1, .use_current = 1},    /* PD_POWER_OPTION_MAX_POWER */  
+#define POLICY_VOLTAGE(v)   {.min_v = 0, .max_v = PD_V(v), .min_i = 0, .min_p = 0, .types = PD_POWER_TYPE_ALL, \
+                             .prefer = {PD_POWER_PREFER_HIGH_VOLTAGE, PD_POWER_PREFER_CURRENT, PD_POWER_PREFER_NONE}}
+#define POLICY_ANY(k1, k2)  {.min_v = 0, .max_v = 0x3FF, .min_i = 0, .min_p = 0, .types = PD_POWER_TYPE_ALL, \
+                             .prefer = {k1, k2, PD_POWER_PREFER_NONE}}
+
+static const PD_power_policy_t power_option_policy[8] PROGMEM = {
+    POLICY_VOLTAGE(5),                                                  /* PD_POWER_OPTION_MAX_5V */
+    POLICY_VOLTAGE(9),                                                  /* PD_POWER_OPTION_MAX_9V */
+    POLICY_VOLTAGE(12),                                                 /* PD_POWER_OPTION_MAX_12V */
+    POLICY_VOLTAGE(15),                                                 /* PD_POWER_OPTION_MAX_15V */
+    POLICY_VOLTAGE(20),                                                 /* PD_POWER_OPTION_MAX_20V */
+    POLICY_ANY(PD_POWER_PREFER_HIGH_VOLTAGE, PD_POWER_PREFER_CURRENT),  /* PD_POWER_OPTION_MAX_VOLTAGE */
+    POLICY_ANY(PD_POWER_PREFER_CURRENT, PD_POWER_PREFER_POWER),         /* PD_POWER_OPTION_MAX_CURRENT */
+    POLICY_ANY(PD_POWER_PREFER_POWER, PD_POWER_PREFER_HIGH_VOLTAGE),    /* PD_POWER_OPTION_MAX_POWER */
 };
 
+static void get_power_point(const PD_power_cache_t * info, PD_power_point_t * pt)
+{
+    pt->min_v = info->type == PD_PDO_TYPE_FIXED_SUPPLY ? info->max_v : info->min_v;
+    pt->max_v = info->max_v;
+    pt->i = info->max_i;
+    if (info->type == PD_PDO_TYPE_BATTERY) {
+        /* Power is fixed, 250mW = 500 x 0.5mW */
+        pt->p = (uint32_t)info->max_p * 500;
+    } else {
+        /* Current is fixed, power is lowest at min voltage */
+        pt->p = (uint32_t)pt->min_v * info->max_i;
+    }
+}
+
+static uint32_t get_power_key(const PD_power_point_t * pt, uint8_t prefer)
+{
+    switch (prefer) {
+    case PD_POWER_PREFER_HIGH_VOLTAGE:  return pt->min_v;
+    case PD_POWER_PREFER_LOW_VOLTAGE:   return (uint16_t)~pt->max_v;
+    case PD_POWER_PREFER_CURRENT:       return pt->i;
+    case PD_POWER_PREFER_POWER:         return pt->p;
+    default:                            return 0;
+    }
+}
+
+static bool is_power_better(const PD_power_policy_t * policy, const PD_power_point_t * pt, const PD_power_point_t * best)
+{
+    for (uint8_t k = 0; k < PD_POWER_POLICY_NUM_OF_PREFER; k++) {
+        uint32_t a = get_power_key(pt, policy->prefer[k]);
+        uint32_t b = get_power_key(best, policy->prefer[k]);
+        if (a != b) {
+            return a > b;
+        }
+    }
+    return false;   /* tie, keep the lower PDO position */
+}
+
 static uint8_t evaluate_src_cap(PD_protocol_t * p, uint16_t PPS_voltage, uint8_t PPS_current)
 {
-    const PD_power_option_setting_t * setting;
-    PD_power_info_t info;
-    uint8_t option = p->power_option;
+    const PD_power_policy_t * policy = &p->power_policy;
+    PD_power_point_t pt, best = {0, 0, 0, 0};
     uint8_t selected = 0;
+    bool found = false;
 
-    /* If selected option is not available, use first PDO. Reference: 6.4.1 Capabilities Message
+    /* If no PDO meets the policy, use first PDO. Reference: 6.4.1 Capabilities Message
        The vSafe5V Fixed Supply Object Shall always be the first object. */
-    if (option >= sizeof(power_option_setting) / sizeof(power_option_setting[0])) {
-        return 0;
-    }
-
-    setting = &power_option_setting[option];
-    for (uint8_t n = 0; PD_protocol_get_power_info(p, n, &info); n++) {
-        if (info.type == PD_PDO_TYPE_AUGMENTED_PDO) {
+    for (uint8_t n = 0; n < p->power_data_obj_count; n++) {
+        const PD_power_cache_t * info = &p->power_cache[n];
+        if (info->type == PD_PDO_TYPE_AUGMENTED_PDO) {
+#if PD_UFP_PPS
             uint16_t pps_v = PPS_voltage * 2;    /* Voltage in 20mV units */
             uint16_t pps_i = PPS_current * 5;    /* Current in 50mA units */
-            /* PD_power_info_t: Voltage in 50mV units, Current in 10mA units */
-            if (info.min_v * 5 <= pps_v && pps_v <= info.max_v * 5 && pps_i <= info.max_i) {
+            /* PD_power_cache_t: Voltage in 50mV units, Current in 10mA units */
+            if (info->min_v * 5 <= pps_v && pps_v <= info->max_v * 5 && pps_i <= info->max_i) {
                 return n;
             }
-        } else {
-            uint8_t v = setting->use_voltage ? info.max_v >> 2 : 1;
-            uint8_t i = setting->use_current ? info.max_i >> 2 : 1;
-            uint16_t power = (uint16_t)v * i;  /* reduce 10-bit power info to 8-bit and use 8-bit x 8-bit multiplication */
-            if (power <= setting->limit) {
-                selected = n;
-            }
+#endif
+            continue;
+        }
+        if (!(policy->types & PD_POWER_TYPE(info->type))) {
+            continue;
+        }
+        get_power_point(info, &pt);
+        if (pt.min_v < policy->min_v || pt.max_v > policy->max_v || pt.i < policy->min_i ||
+            pt.p < (uint32_t)policy->min_p * 500) {
+            continue;
+        }
+        if (!found || is_power_better(policy, &pt, &best)) {
+            best = pt;
+            selected = n;
+            found = true;
         }
     }
     return selected;
@@ -236,6 +344,7 @@ static uint16_t generate_header(PD_protocol_t * p, uint8_t type, uint8_t obj_cou
     return h;
 }
 
+#if PD_UFP_EXT_MSG
 static uint16_t generate_header_ext(PD_protocol_t * p, uint8_t type, uint8_t data_size, uint32_t * obj)
 {
     uint16_t h = generate_header(p, type, (data_size + 5) >> 2); /* set obj_count to fit ext header and data */
@@ -247,6 +356,7 @@ static uint16_t generate_header_ext(PD_protocol_t * p, uint8_t type, uint8_t dat
     p->tx_msg_header = h;
     return h;
 }
+#endif
 
 static void handler_good_crc(PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events)
 {
@@ -274,7 +384,7 @@ static void handler_accept(PD_protocol_t * p, uint16_t header, uint32_t * obj, P
 static void handler_reject(PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events)
 {
     if (events) {
-        *events |= PD_PROTOCOL_EVENT_PS_RDY;
+        *events |= PD_PROTOCOL_EVENT_REJECT;
     }
 }
 
@@ -285,15 +395,55 @@ static void handler_ps_rdy(PD_protocol_t * p, uint16_t header, uint32_t * obj, P
     }
 }
 
+static uint16_t battery_current(uint16_t max_p, uint16_t max_v)
+{
+    /* Current is lowest at max voltage. 250mW = 500 x 0.5mW, 0.5mW / 50mV = 10mA */
+    uint32_t i = max_v ? (uint32_t)max_p * 500 / max_v : 0;
+    return i > 0xFFFF ? 0xFFFF : i;
+}
+
+static void decode_power_data_obj(PD_power_cache_t * info, uint32_t obj)
+{
+    info->type = obj >> 30;
+    info->max_p = 0;
+    switch (info->type) {
+    case PD_PDO_TYPE_FIXED_SUPPLY:
+        /* Reference: 6.4.1.2.3 Source Fixed Supply Power Data Object */
+        info->min_v = 0;
+        info->max_v = (obj >> 10) & 0x3FF;    /*  B19...10  Voltage in 50mV units */
+        info->max_i = (obj >>  0) & 0x3FF;    /*  B9 ...0   Max Current in 10mA units */
+        break;
+    case PD_PDO_TYPE_BATTERY:
+        /* Reference: 6.4.1.2.5 Battery Supply Power Data Object */
+        info->min_v = (obj >> 10) & 0x3FF;    /*  B19...10  Min Voltage in 50mV units */
+        info->max_v = (obj >> 20) & 0x3FF;    /*  B29...20  Max Voltage in 50mV units */
+        info->max_p = (obj >>  0) & 0x3FF;    /*  B9 ...0   Max Allowable Power in 250mW units */
+        info->max_i = battery_current(info->max_p, info->max_v);
+        break;
+    case PD_PDO_TYPE_VARIABLE_SUPPLY:
+        /* Reference: 6.4.1.2.4 Variable Supply (non-Battery) Power Data Object */
+        info->min_v = (obj >> 10) & 0x3FF;    /*  B19...10  Min Voltage in 50mV units */
+        info->max_v = (obj >> 20) & 0x3FF;    /*  B29...20  Max Voltage in 50mV units */
+        info->max_i = (obj >>  0) & 0x3FF;    /*  B9 ...0   Max Current in 10mA units */
+        break;
+    default:
+        /* Reference: 6.4.1.3.4 Programmable Power Supply Augmented Power Data Object */
+        info->max_v = ((obj >> 17) & 0xFF) * 2;   /*  B24...17  Max Voltage in 100mV units */
+        info->min_v = ((obj >>  8) & 0xFF) * 2;   /*  B15...8   Min Voltage in 100mV units */
+        info->max_i = ((obj >>  0) & 0x7F) * 5;   /*  B6 ...0   Max Current in 50mA units */
+        break;
+    }
+}
+
 static void handler_source_cap(PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events)
 {
     PD_msg_header_info_t h;
     parse_header(&h, header);
     p->power_data_obj_count = h.num_of_obj;
     for (uint8_t i = 0; i < h.num_of_obj; i++) {
-        p->power_data_obj[i] = obj[i];
+        decode_power_data_obj(&p->power_cache[i], obj[i]);
     }
-    p->power_data_obj_selected = evaluate_src_cap(p, p->PPS_voltage, p->PPS_current);
+    p->power_data_obj_selected = evaluate_src_cap(p, PPS_SETTING(p));
     if (events) {
         *events |= PD_PROTOCOL_EVENT_SRC_CAP;
     }
@@ -314,6 +464,7 @@ static void handler_vender_def(PD_protocol_t * p, uint16_t header, uint32_t * ob
     // TODO: implement VDM parsing
 }
 
+#if PD_UFP_PPS_STATUS
 static void handler_PPS_Status(PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events)
 {
     /* Handle chunked Extended message,  Offset 2 byte for Extended Message Header */
@@ -325,6 +476,7 @@ static void handler_PPS_Status(PD_protocol_t * p, uint16_t header, uint32_t * ob
         *events |= PD_PROTOCOL_EVENT_PPS_STATUS;
     }
 }
+#endif
 
 static bool responder_get_sink_cap(PD_protocol_t * p, uint16_t * header, uint32_t * obj)
 {
@@ -339,6 +491,7 @@ static bool responder_get_sink_cap(PD_protocol_t * p, uint16_t * header, uint32_
     return true;
 }
 
+#if PD_UFP_EXT_MSG
 static bool responder_sink_cap_ext(PD_protocol_t * p, uint16_t * header, uint32_t * obj)
 {
     /* Reference: 6.5.13 Sink_Capabilities_Extended Message 
@@ -382,6 +535,7 @@ static bool responder_sink_cap_ext(PD_protocol_t * p, uint16_t * header, uint32_
     *header = generate_header_ext(p, PD_EXT_MSG_TYPE_SINK_CAP_EXT, 21, obj);
     return false;
 }
+#endif
 
 static bool responder_reject(PD_protocol_t * p, uint16_t * header, uint32_t * obj)
 {
@@ -403,18 +557,20 @@ static bool responder_soft_reset(PD_protocol_t * p, uint16_t * header, uint32_t
 
 static bool responder_source_cap(PD_protocol_t * p, uint16_t * header, uint32_t * obj)
 {
-    PD_power_info_t info;
+    const PD_power_cache_t * info = &p->power_cache[p->power_data_obj_selected];
     uint32_t data, pos = p->power_data_obj_selected + 1;
-    PD_protocol_get_power_info(p, p->power_data_obj_selected, &info);
     /* Reference: 6.4.2 Request Message */
-    if (info.type == PD_PDO_TYPE_AUGMENTED_PDO) {
+#if PD_UFP_PPS
+    if (info->type == PD_PDO_TYPE_AUGMENTED_PDO) {
         /* NOTE: To compatible PD2.0 PHY, do not set Unchunked Extended Messages Supported */
         data = ((uint32_t)p->PPS_current << 0) |    /* B6 ...0    Operating Current 50mA units */
                ((uint32_t)p->PPS_voltage << 9) |    /* B19...9    Output Voltage in 20mV units */
                ((uint32_t)1 << 25) |                /* B25        USB Communication Capable */
                ((uint32_t)pos << 28);               /* B30...28   Object position (000b is Reserved and Shall Not be used) */
-    } else {
-        uint32_t req = info.max_i ? info.max_i : info.max_p;
+    } else
+#endif
+    {
+        uint32_t req = info->type == PD_PDO_TYPE_BATTERY ? info->max_p : info->max_i;
         data = ((uint32_t)req << 0) |    /* B9 ...0    Max Operating Current 10mA units / Max Operating Power in 250mW units */
                ((uint32_t)req << 10) |   /* B19...10   Operating Current 10mA units / Operating Power in 250mW units */
                ((uint32_t)1 << 25) |     /* B25        USB Communication Capable */
@@ -431,33 +587,52 @@ static bool responder_vender_def(PD_protocol_t * p, uint16_t * header, uint32_t
     return false;
 }
 
-void PD_protocol_handle_msg(PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events)
+static const struct PD_msg_state_t * find_msg_state(uint16_t header, PD_msg_header_info_t * h)
 {
     #define EXT_MSG_LIMIT   (sizeof(ext_msg_list) / sizeof(ext_msg_list[0]) - 1)
     #define DATA_MSG_LIMIT  (sizeof(data_msg_list) / sizeof(data_msg_list[0]) - 1)
     #define CTRL_MSG_LIMIT  (sizeof(ctrl_msg_list) / sizeof(ctrl_msg_list[0]) - 1)
 
+    parse_header(h, header);
+    if ((header >> 15) & 0x1) {
+        return &ext_msg_list[h->type > EXT_MSG_LIMIT ? EXT_MSG_LIMIT : h->type];
+    } else if (h->num_of_obj) {
+        return &data_msg_list[h->type > DATA_MSG_LIMIT ? DATA_MSG_LIMIT : h->type];
+    }
+    return &ctrl_msg_list[h->type > CTRL_MSG_LIMIT ? CTRL_MSG_LIMIT : h->type];
+}
+
+void PD_protocol_handle_msg(PD_protocol_t * p, uint16_t header, uint32_t * obj, PD_protocol_event_t * events)
+{
     const struct PD_msg_state_t * state;
+    PD_msg_handler_t handler;
     PD_msg_header_info_t h;
-    parse_header(&h, header);
+    state = find_msg_state(header, &h);
     p->rx_msg_header = header;
-    if ((header >> 15) & 0x1) {
-        state = &ext_msg_list[h.type > EXT_MSG_LIMIT ? EXT_MSG_LIMIT : h.type];
-    } else if (h.num_of_obj) {
-        state = &data_msg_list[h.type > DATA_MSG_LIMIT ? DATA_MSG_LIMIT : h.type];
-    } else {
-        state =&ctrl_msg_list[h.type > CTRL_MSG_LIMIT ? CTRL_MSG_LIMIT : h.type];
+    if (state != &ctrl_msg_list[PD_CONTROL_MSG_TYPE_GOOD_CRC]) {
+        /* Reference: 6.7.1.2 MessageID Counter. A message is retransmitted with the same MessageID
+           when the GoodCRC was lost, drop it. Soft_Reset is always processed. */
+        if (h.id == p->rx_message_id && state != &ctrl_msg_list[PD_CONTROL_MSG_TYPE_SOFT_RESET]) {
+            return;
+        }
+        p->rx_message_id = h.id;
     }
-    SET_MSG_STAGE(p->msg_state, state);
-    if (p->msg_state->handler) {
-        p->msg_state->handler(p, header, obj, events);
+    if (state != &ctrl_msg_list[PD_CONTROL_MSG_TYPE_GOOD_CRC]) {
+        p->rx_respond_header = MSG_RESPONDER(state) ? header : 0;
+    }
+    handler = MSG_HANDLER(state);
+    if (handler) {
+        handler(p, header, obj, events);
     }
 }
 
 bool PD_protocol_respond(PD_protocol_t * p, uint16_t * header, uint32_t * obj)
 {
-    if (p && p->msg_state && p->msg_state->responder && header && obj) {
-        return p->msg_state->responder(p, (uint16_t *)header, obj);
+    if (p && p->rx_respond_header && header && obj) {
+        PD_msg_header_info_t h;
+        PD_msg_responder_t responder = MSG_RESPONDER(find_msg_state(p->rx_respond_header, &h));
+        p->rx_respond_header = 0;
+        return responder(p, header, obj);
     }
     return false;
 }
@@ -467,10 +642,12 @@ void PD_protocol_create_get_src_cap(PD_protocol_t * p, uint16_t * header)
     *header = generate_header(p, PD_CONTROL_MSG_TYPE_GET_SRC_CAP, 0);
 }
 
+#if PD_UFP_PPS_STATUS
 void PD_protocol_create_get_PPS_status(PD_protocol_t *p, uint16_t *header)
 {
     *header = generate_header(p, PD_CONTROL_MSG_TYPE_GET_PPS_STATUS, 0);
 }
+#endif
 
 void PD_protocol_create_request(PD_protocol_t * p, uint16_t * header, uint32_t * obj)
 {
@@ -480,38 +657,12 @@ void PD_protocol_create_request(PD_protocol_t * p, uint16_t * header, uint32_t *
 bool PD_protocol_get_power_info(PD_protocol_t * p, uint8_t index, PD_power_info_t * power_info)
 {
     if (p && index < p->power_data_obj_count && power_info) {
-        uint32_t obj = p->power_data_obj[index];
-        power_info->type = (PD_power_data_obj_type_t)(obj >> 30);
-        switch (power_info->type) {
-        case PD_PDO_TYPE_FIXED_SUPPLY:
-            /* Reference: 6.4.1.2.3 Source Fixed Supply Power Data Object */
-            power_info->min_v = 0;
-            power_info->max_v = (obj >> 10) & 0x3FF;    /*  B19...10  Voltage in 50mV units */
-            power_info->max_i = (obj >>  0) & 0x3FF;    /*  B9 ...0   Max Current in 10mA units */
-            power_info->max_p = 0;
-            break;
-        case PD_PDO_TYPE_BATTERY:
-            /* Reference: 6.4.1.2.5 Battery Supply Power Data Object */
-            power_info->min_v = (obj >> 10) & 0x3FF;    /*  B19...10  Min Voltage in 50mV units */
-            power_info->max_v = (obj >> 20) & 0x3FF;    /*  B29...20  Max Voltage in 50mV units */
-            power_info->max_i = 0;
-            power_info->max_p = (obj >>  0) & 0x3FF;    /*  B9 ...0   Max Allowable Power in 250mW units */
-            break;
-        case PD_PDO_TYPE_VARIABLE_SUPPLY:
-            /* Reference: 6.4.1.2.4 Variable Supply (non-Battery) Power Data Object */
-            power_info->min_v = (obj >> 10) & 0x3FF;    /*  B19...10  Min Voltage in 50mV units */
-            power_info->max_v = (obj >> 20) & 0x3FF;    /*  B29...20  Max Voltage in 50mV units */
-            power_info->max_i = (obj >>  0) & 0x3FF;    /*  B9 ...0   Max Current in 10mA units */
-            power_info->max_p = 0;
-            break;
-        case PD_PDO_TYPE_AUGMENTED_PDO:
-            /* Reference: 6.4.1.3.4 Programmable Power Supply Augmented Power Data Object */
-            power_info->max_v = ((obj >> 17) & 0xFF) * 2;   /*  B24...17  Max Voltage in 100mV units */
-            power_info->min_v = ((obj >>  8) & 0xFF) * 2;   /*  B15...8   Min Voltage in 100mV units */
-            power_info->max_i = ((obj >>  0) & 0x7F) * 5;   /*  B6 ...0   Max Current in 50mA units */
-            power_info->max_p = 0;
-            break;
-        }
+        const PD_power_cache_t * info = &p->power_cache[index];
+        power_info->type = (PD_power_data_obj_type_t)info->type;
+        power_info->min_v = info->min_v;
+        power_info->max_v = info->max_v;
+        power_info->max_i = info->max_p ? 0 : info->max_i;
+        power_info->max_p = info->max_p;
         return true;
     }
     return false;
@@ -522,13 +673,6 @@ bool PD_protocol_get_msg_info(uint16_t header, PD_msg_info_t * msg_info)
     PD_msg_header_info_t h;
     parse_header(&h, header);
     if (msg_info) {
-        const char * name;
-        const struct PD_msg_state_t * state;
-        uint8_t type = h.type;
-        SET_MSG_STAGE(state, header & 0x8000 ? &ext_msg_list[type] :
-                        h.num_of_obj ? &data_msg_list[type] : &ctrl_msg_list[type]);
-        SET_MSG_NAME(name, state->name);
-        msg_info->name = name;
         msg_info->id = h.id;
         msg_info->spec_rev = h.spec_rev;
         msg_info->num_of_obj = h.num_of_obj;
@@ -538,6 +682,22 @@ bool PD_protocol_get_msg_info(uint16_t header, PD_msg_info_t * msg_info)
     return false;
 }
 
+uint8_t PD_protocol_get_msg_name(uint16_t header, char * name, uint8_t maxlen)
+{
+    if (name && maxlen) {
+#if PD_UFP_MSG_NAMES
+        PD_msg_header_info_t h;
+        COPY_MSG_NAME(name, MSG_NAME_PTR(find_msg_state(header, &h)), maxlen - 1);
+        name[maxlen - 1] = 0;
+#else
+        name[0] = 0;
+#endif
+        return strlen(name);
+    }
+    return 0;
+}
+
+#if PD_UFP_PPS_STATUS
 bool PD_protocol_get_PPS_status(PD_protocol_t *p, PPS_status_t * PPS_status)
 {
     if (p && PPS_status) {
@@ -550,14 +710,28 @@ bool PD_protocol_get_PPS_status(PD_protocol_t *p, PPS_status_t * PPS_status)
     }
     return false;
 }
+#endif
 
 bool PD_protocol_set_power_option(PD_protocol_t * p, enum PD_power_option_t option)
 {
-    p->power_option = option;
+    PD_power_policy_t policy;
+    if ((uint8_t)option < sizeof(power_option_policy) / sizeof(power_option_policy[0])) {
+        COPY_POLICY(policy, power_option_policy[option]);
+    } else {
+        memset(&policy, 0, sizeof(policy)); /* No PDO qualifies, use vSafe5V */
+    }
+    return PD_protocol_set_power_policy(p, &policy);
+}
+
+bool PD_protocol_set_power_policy(PD_protocol_t * p, const PD_power_policy_t * policy)
+{
+    p->power_policy = *policy;
+#if PD_UFP_PPS
     p->PPS_voltage = 0;
     p->PPS_current = 0;
+#endif
     if (p->power_data_obj_count > 0) {
-        p->power_data_obj_selected = evaluate_src_cap(p, p->PPS_voltage, p->PPS_current);
+        p->power_data_obj_selected = evaluate_src_cap(p, PPS_SETTING(p));
         return true;    /* need to re-send request */
     }
     return false;
@@ -572,11 +746,12 @@ bool PD_protocol_select_power(PD_protocol_t * p, uint8_t index)
     return false;
 }
 
+#if PD_UFP_PPS
 bool PD_protocol_set_PPS(PD_protocol_t * p, uint16_t PPS_voltage, uint8_t PPS_current, bool strict)
 {
     if (p->PPS_voltage != PPS_voltage || p->PPS_current != PPS_current) {
         uint8_t selected = evaluate_src_cap(p, PPS_voltage, PPS_current);
-        if (selected || !strict) {
+        if (p->power_cache[selected].type == PD_PDO_TYPE_AUGMENTED_PDO || !strict) {
             p->PPS_voltage = PPS_voltage;
             p->PPS_current = PPS_current;
             p->power_data_obj_selected = selected;
@@ -586,14 +761,66 @@ bool PD_protocol_set_PPS(PD_protocol_t * p, uint16_t PPS_voltage, uint8_t PPS_cu
     return false;
 }
 
+bool PD_protocol_check_PPS(PD_protocol_t * p, uint16_t PPS_voltage, uint8_t PPS_current)
+{
+    uint8_t selected = evaluate_src_cap(p, PPS_voltage, PPS_current);
+    return p->power_data_obj_count > 0 && p->power_cache[selected].type == PD_PDO_TYPE_AUGMENTED_PDO;
+}
+#endif
+
+#if PD_UFP_PPS_STATUS
+bool PD_protocol_regulate_PPS(PD_protocol_t * p, uint16_t target, uint16_t cable_mohm, uint8_t max_step)
+{
+    const PD_power_cache_t * info = &p->power_cache[p->power_data_obj_selected];
+    PPS_status_t status;
+    int32_t next;
+    int16_t error;
+    uint16_t v, min_v, max_v;
+    if (p->power_data_obj_count == 0 || info->type != PD_PDO_TYPE_AUGMENTED_PDO || p->PPS_voltage == 0) {
+        return false;
+    }
+    PD_protocol_get_PPS_status(p, &status);
+    if (status.output_voltage == 0xFFFF) {
+        return false;   /* Output voltage not reported, nothing to regulate on */
+    }
+    /* Load voltage = output voltage - cable drop. 50mA x 1mOhm = 0.05mV = 1/400 of 20mV. Without current no drop */
+    v = status.output_voltage;
+    if (status.output_current != 0xFF) {
+        uint16_t drop = ((uint32_t)status.output_current * cable_mohm + 200) / 400;
+        v = drop < v ? v - drop : 0;
+    }
+    /* Integrate the error, one LSB dead band to not chase the 20mV resolution of the report */
+    error = (int16_t)(target - v);
+    if (error >= -1 && error <= 1) {
+        return false;
+    }
+    if (error > max_step) {
+        error = max_step;
+    } else if (error < -(int16_t)max_step) {
+        error = -(int16_t)max_step;
+    }
+    /* APDO range, 50mV units to 20mV units */
+    min_v = (info->min_v * 5 + 1) / 2;
+    max_v = (info->max_v * 5) / 2;
+    next = (int32_t)p->PPS_voltage + error;
+    next = next < min_v ? min_v : next > max_v ? max_v : next;
+    if (next == p->PPS_voltage) {
+        return false;
+    }
+    p->PPS_voltage = next;
+    return true;    /* need to re-send request */
+}
+#endif
+
 void PD_protocol_reset(PD_protocol_t * p)
 {
-    p->msg_state = &ctrl_msg_list[0];
     p->message_id = 0;
+    p->rx_message_id = 0xFF;
+    p->rx_respond_header = 0;
 }
 
 void PD_protocol_init(PD_protocol_t * p)
 {
     memset(p, 0, sizeof(PD_protocol_t));
-    p->msg_state = &ctrl_msg_list[0];
+    p->rx_message_id = 0xFF;
 }
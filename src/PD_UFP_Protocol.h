@@ -12,6 +12,7 @@
  *
  * Support PD3.0 PPS
  * Do not support extended message. Not necessary for PD trigger and PPS.
+ * Features are selected at compile time, see PD_UFP_Config.h
  * 
  * Reference: USB_PD_R2_0 V1.3 - 20170112
  *            USB_PD_R3_0 V2.0 20190829 + ECNs 2020-12-10
@@ -25,9 +26,12 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "PD_UFP_Config.h"
+
 /* For use in PD_protocol_get_power_info() */
 #define PD_V(v)     ((uint16_t)(v * 20 + 0.01))
 #define PD_A(a)     ((uint16_t)(a * 100 + 0.01))
+#define PD_W(w)     ((uint16_t)(w * 4 + 0.01))
 
 /* For use in PD_protocol_set_PPS_option() */
 #define PPS_V(v)    ((uint16_t)(v * 50 + 0.01))
@@ -54,6 +58,14 @@ enum PD_power_option_t {
     PD_POWER_OPTION_MAX_POWER   = 7,
 };
 
+enum PD_power_prefer_t {          /* Ranking keys of PD_power_policy_t, first key decides, later keys break ties */
+    PD_POWER_PREFER_NONE            = 0,
+    PD_POWER_PREFER_HIGH_VOLTAGE    = 1,    /* Highest guaranteed voltage */
+    PD_POWER_PREFER_LOW_VOLTAGE     = 2,    /* Lowest maximum voltage */
+    PD_POWER_PREFER_CURRENT         = 3,    /* Highest guaranteed current */
+    PD_POWER_PREFER_POWER           = 4,    /* Highest guaranteed power */
+};
+
 enum PD_power_data_obj_type_t {   /* Power data object type */
     PD_PDO_TYPE_FIXED_SUPPLY    = 0,
     PD_PDO_TYPE_BATTERY         = 1,
@@ -81,7 +93,6 @@ typedef struct {
 } PPS_status_t;
 
 typedef struct {
-    const char * name;
     uint8_t id;
     uint8_t spec_rev;
     uint8_t num_of_obj;
@@ -96,53 +107,108 @@ typedef struct {
     uint16_t max_p;     /* Power in 250mW units */
 } PD_power_info_t;
 
-struct PD_msg_state_t;
+typedef struct {        /* PDO decoded once per Source_Capabilities, read through PD_protocol_get_power_info() */
+    uint8_t type;       /* enum PD_power_data_obj_type_t */
+    uint16_t min_v;     /* Voltage in 50mV units, 0 for fixed supply */
+    uint16_t max_v;     /* Voltage in 50mV units */
+    uint16_t max_i;     /* Current in 10mA units, for battery supply the current at max_v */
+    uint16_t max_p;     /* Power in 250mW units for battery supply, 0 otherwise */
+} PD_power_cache_t;
+
+/* Bit of PD_power_policy_t.types */
+#define PD_POWER_TYPE(t)        (1 << (t))
+#define PD_POWER_TYPE_ALL       (PD_POWER_TYPE(PD_PDO_TYPE_FIXED_SUPPLY) | PD_POWER_TYPE(PD_PDO_TYPE_BATTERY) | \
+                                 PD_POWER_TYPE(PD_PDO_TYPE_VARIABLE_SUPPLY))
+
+#define PD_POWER_POLICY_NUM_OF_PREFER   3
+
+typedef struct {        /* Requirements for Fixed, Variable and Battery PDO selection, PPS is set by PD_protocol_set_PPS() */
+    uint16_t min_v;     /* Voltage in 50mV units, whole voltage range of the PDO must be within min_v ... max_v */
+    uint16_t max_v;     /* Voltage in 50mV units */
+    uint16_t min_i;     /* Current in 10mA units, guaranteed over the voltage range */
+    uint16_t min_p;     /* Power in 250mW units, guaranteed over the voltage range */
+    uint8_t types;      /* Accepted PDO types, PD_POWER_TYPE() bits */
+    uint8_t prefer[PD_POWER_POLICY_NUM_OF_PREFER];  /* enum PD_power_prefer_t, ties left are won by the lower PDO position */
+} PD_power_policy_t;
+
 typedef struct {
-    const struct PD_msg_state_t *msg_state;
     uint16_t tx_msg_header;
     uint16_t rx_msg_header;
+    uint16_t rx_respond_header; /* Header of received message waiting for PD_protocol_respond(), 0 if none */
+    uint8_t rx_message_id;      /* MessageID of last received message, 0xFF after reset */
     uint8_t message_id;
 
+#if PD_UFP_PPS
     uint16_t PPS_voltage;
     uint8_t PPS_current;
+#endif
+#if PD_UFP_PPS_STATUS
     uint8_t PPSSDB[4];  /* PPS Status Data Block */
+#endif
 
-    enum PD_power_option_t power_option;
-    uint32_t power_data_obj[PD_PROTOCOL_MAX_NUM_OF_PDO];
+    PD_power_policy_t power_policy;
+    PD_power_cache_t power_cache[PD_PROTOCOL_MAX_NUM_OF_PDO];
     uint8_t power_data_obj_count;
     uint8_t power_data_obj_selected;
 } PD_protocol_t;
 
-/* Message handler */
+/* Message handler, retransmitted messages (same MessageID) are ignored.
+   PD_protocol_respond() creates the response of the last handled message once, it can be deferred
+   as long as the response is sent within tSenderResponse */
 void PD_protocol_handle_msg(PD_protocol_t *p, uint16_t header, uint32_t *obj, PD_protocol_event_t *events);
 bool PD_protocol_respond(PD_protocol_t *p, uint16_t *h, uint32_t *obj);
 
 /* PD Message creation */
 void PD_protocol_create_get_src_cap(PD_protocol_t *p, uint16_t *header);
+#if PD_UFP_PPS_STATUS
 void PD_protocol_create_get_PPS_status(PD_protocol_t *p, uint16_t *header);
+#endif
 void PD_protocol_create_request(PD_protocol_t *p, uint16_t *header, uint32_t *obj);
 
 /* Get functions */
 static inline uint8_t  PD_protocol_get_selected_power(PD_protocol_t *p) { return p->power_data_obj_selected; }
+#if PD_UFP_PPS
 static inline uint16_t PD_protocol_get_PPS_voltage(PD_protocol_t *p) { return p->PPS_voltage; } /* Voltage in 20mV units */
 static inline uint8_t  PD_protocol_get_PPS_current(PD_protocol_t *p) { return p->PPS_current; } /* Current in 50mA units */
+#endif
 
 static inline uint16_t PD_protocol_get_tx_msg_header(PD_protocol_t *p) { return p->tx_msg_header; }
 static inline uint16_t PD_protocol_get_rx_msg_header(PD_protocol_t *p) { return p->rx_msg_header; }
+static inline bool PD_protocol_respond_pending(PD_protocol_t *p) { return p->rx_respond_header != 0; }
+/* Request data message, e.g. to check which message failed */
+static inline bool PD_protocol_is_request(uint16_t header) { return (header & 0x801F) == 0x0002 && (header & 0x7000); }
 
 bool PD_protocol_get_msg_info(uint16_t header, PD_msg_info_t * msg_info);
+/* Copy the message name to name (at most maxlen - 1 characters), returns the length.
+   Empty without PD_UFP_MSG_NAMES */
+uint8_t PD_protocol_get_msg_name(uint16_t header, char * name, uint8_t maxlen);
 
 bool PD_protocol_get_power_info(PD_protocol_t *p, uint8_t index, PD_power_info_t *power_info);
+#if PD_UFP_PPS_STATUS
 bool PD_protocol_get_PPS_status(PD_protocol_t *p, PPS_status_t * PPS_status);
+#endif
 
-/* Set Fixed and Variable power option */
+/* Set Fixed, Variable and Battery power selection. A power option is a predefined policy.
+   If no PDO meets the policy, the vSafe5V PDO is selected. Return true if re-send request is needed */
 bool PD_protocol_set_power_option(PD_protocol_t *p, enum PD_power_option_t option);
+bool PD_protocol_set_power_policy(PD_protocol_t *p, const PD_power_policy_t *policy);
 bool PD_protocol_select_power(PD_protocol_t *p, uint8_t index);
 
+#if PD_UFP_PPS
 /* Set PPS Voltage in 20mV units, Current in 50mA units. return true if re-send request is needed
    strict=true, If PPS setting is not qualified, return false, nothing is changed.
    strict=false, if PPS setting is not qualified, fall back to regular power option */
 bool PD_protocol_set_PPS(PD_protocol_t * p, uint16_t PPS_voltage, uint8_t PPS_current, bool strict);  
+/* Return true if the PPS setting is qualified by an APDO, nothing is changed */
+bool PD_protocol_check_PPS(PD_protocol_t * p, uint16_t PPS_voltage, uint8_t PPS_current);
+#endif
+
+#if PD_UFP_PPS_STATUS
+/* Closed-loop PPS, call after PD_PROTOCOL_EVENT_PPS_STATUS. Move the PPS voltage toward target (20mV units) at the load,
+   estimated from the PPS_Status output voltage and current and the cable resistance in mOhm.
+   A step is at most max_step (20mV units) and stays within the selected APDO. Return true if re-send request is needed */
+bool PD_protocol_regulate_PPS(PD_protocol_t * p, uint16_t target, uint16_t cable_mohm, uint8_t max_step);
+#endif
 
 void PD_protocol_reset(PD_protocol_t *p);
 void PD_protocol_init(PD_protocol_t *p);
@@ -0,0 +1,60 @@
+/**
+ * PD_UFP_Ring.h
+ *
+ * Lock-free single producer, single consumer ring buffer, e.g. the status log of PD_UFP_Log_c.
+ * The producer may run in an interrupt while the consumer runs in the main loop, or the other way.
+ * Only the producer writes the write index and only the consumer the read index. Entries are
+ * published with release / acquire ordering, so the ring also works between cores.
+ * SIZE is a power of 2 and <= 128, all SIZE entries are usable. Entries that do not fit are
+ * counted, see get_dropped().
+ *
+ */
+
+#ifndef PD_UFP_RING_H
+#define PD_UFP_RING_H
+
+#include <stdint.h>
+
+template <typename T, uint16_t SIZE>
+class PD_UFP_ring_c
+{
+    static_assert(SIZE && SIZE <= 128 && (SIZE & (SIZE - 1)) == 0, "ring size must be a power of 2 and <= 128");
+
+    public:
+        PD_UFP_ring_c(): read(0), write(0), dropped(0) {}
+        // Producer
+        uint8_t space(void) const { return SIZE - (uint8_t)(write - __atomic_load_n(&read, __ATOMIC_ACQUIRE)); }
+        T * back(void) { return &buf[write & (SIZE - 1)]; }     /* next free entry, valid if space() */
+        void push(void) { __atomic_store_n(&write, (uint8_t)(write + 1), __ATOMIC_RELEASE); }
+        bool push(const T & value) {
+            if (space() == 0) {
+                drop(1);
+                return false;
+            }
+            *back() = value;
+            push();
+            return true;
+        }
+        void drop(uint16_t count) { dropped = dropped + count; }
+        // Consumer
+        uint8_t count(void) const { return (uint8_t)(__atomic_load_n(&write, __ATOMIC_ACQUIRE) - read); }
+        T * front(void) { return &buf[read & (SIZE - 1)]; }     /* oldest entry, valid if count() */
+        void pop(void) { __atomic_store_n(&read, (uint8_t)(read + 1), __ATOMIC_RELEASE); }
+        void clear(void) { __atomic_store_n(&read, __atomic_load_n(&write, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE); }
+        // Entries dropped since start, wraps at 2^16. Any context
+        uint16_t get_dropped(void) const {
+            uint16_t n;
+            do {
+                n = dropped;    /* not atomic on 8-bit MCUs, read again if the producer interrupted */
+            } while (n != dropped);
+            return n;
+        }
+
+    protected:
+        T buf[SIZE];
+        uint8_t read;
+        uint8_t write;
+        volatile uint16_t dropped;
+};
+
+#endif /* PD_UFP_RING_H */